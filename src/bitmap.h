@@ -144,6 +144,16 @@ public:
            __builtin_popcountl(_bits[3]);
   }
 
+  // clear every bit set in mask (one word per bitmap word) in four
+  // atomic fetch_ands, writing the previous words to oldBits so the
+  // caller can tell which bits it actually cleared
+  inline void ATTRIBUTE_ALWAYS_INLINE unsetMask(const size_t *mask, size_t *oldBits) {
+    oldBits[0] = _bits[0].fetch_and(~mask[0], std::memory_order_acq_rel);
+    oldBits[1] = _bits[1].fetch_and(~mask[1], std::memory_order_acq_rel);
+    oldBits[2] = _bits[2].fetch_and(~mask[2], std::memory_order_acq_rel);
+    oldBits[3] = _bits[3].fetch_and(~mask[3], std::memory_order_acq_rel);
+  }
+
 protected:
   inline void nullBits() {
   }
@@ -65,12 +65,16 @@ static constexpr int kMapShared = kMeshingEnabled ? MAP_SHARED : MAP_PRIVATE | M
 #endif
 
 static constexpr size_t kMinObjectSize = 16;
-static constexpr size_t kMaxSize = 16384;
-static constexpr size_t kClassSizesMax = 25;
+static constexpr size_t kMaxSize = 262144;
+static constexpr size_t kClassSizesMax = 33;
 static constexpr size_t kAlignment = 8;
 static constexpr int kMinAlign = 16;
 static constexpr uint64_t kPageSize = 4096;
-static constexpr size_t kMaxFastLargeSize = 256 * 1024;  // 256Kb
+static constexpr size_t kMaxFastLargeSize = 1024 * 1024;  // 1MB
+
+// how many recently-freed large spans we retain per page-count bucket
+// before frees go back to the arena
+static constexpr size_t kLargeSpanCacheDepth = 8;
 
 static constexpr size_t kMaxSplitListSize = 16384;
 static constexpr size_t kMaxMergeSets = 4096;
@@ -78,6 +82,12 @@ static constexpr size_t kMaxMergeSets = 4096;
 // cutoff to be considered for meshing
 static constexpr double kOccupancyCutoff = .8;
 
+// partially-full miniheaps are kept bucketed by occupancy band
+// ([0,.25), [.25,.5), [.5,kOccupancyCutoff), and >= kOccupancyCutoff)
+// so the mesh scan walks only plausible candidates; the top band is
+// never scanned.
+static constexpr size_t kOccupancyBands = 4;
+
 // if we have, e.g. a kernel-imposed max_map_count of 2^16 (65k) we
 // can only safely have about 30k meshes before we are at risk of
 // hitting the max_map_count limit. Must smaller than 1/3, because
@@ -93,18 +103,55 @@ static constexpr size_t kMaxMeshesPerIteration = 2500;
 static constexpr size_t kMaxDirtyPageThreshold = 1 << 14;  // 64 MB in pages
 static constexpr size_t kMinDirtyPageThreshold = 32;       // 128 KB in pages
 
+// how many address ranges we pack into a single process_madvise(2)
+// call when scavenging; the kernel caps an iovec at UIO_MAXIOV (1024)
+static constexpr size_t kMadviseBatchSize = 256;
+
+// each identity-mapping restore is a TLB-shootdown-inducing
+// MAP_FIXED mmap; cap how many a single scavenge issues (the rest
+// carry over to the next cycle)
+static constexpr size_t kMaxSpanResetsPerScavenge = 256;
+
+// background scavenger: how often the background thread wakes up, and
+// the most dirty pages a single wakeup may madvise back to the OS.
+// Together these rate-limit page release to keep madvise bursts from
+// competing with allocating threads for the arena lock.
+static constexpr std::chrono::milliseconds kScavengeIntervalMs{50};
+static constexpr size_t kScavengeBatchPages = 1024;  // 4 MB in pages
+
 static constexpr uint32_t kSpanClassCount = 256;
 
-static constexpr int kNumBins = 25;  // 16Kb max object size
+static constexpr int kNumBins = 33;  // 256Kb max object size
 static constexpr int kDefaultMeshPeriod = 10000;
 
 static constexpr size_t kMinArenaExpansion = 4096;  // 16 MB in pages
 
+// the transparent-huge-page tier of the arena grows in 2MB-aligned
+// chunks; spans whose miniheaps can never mesh are carved from it so
+// beginMesh never breaks a huge page apart.
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
 // ensures we amortize the cost of going to the global heap enough
 static constexpr uint64_t kMinStringLen = 8;
 static constexpr size_t kMiniheapRefillGoalSize = 4 * 1024;
 static constexpr size_t kMaxMiniheapsPerShuffleVector = 24;
 
+// how many cross-thread frees a thread buffers before flushing them
+// to the global heap in one batch, and a byte bound on what the
+// buffer may hold: with size classes up to 256KB, a slot bound alone
+// would let one idle thread retain megabytes of freed-but-unflushed
+// memory (and overstate those miniheaps' occupancy to the mesh scan)
+static constexpr size_t kFreeBufferSize = 32;
+static constexpr size_t kFreeBufferMaxBytes = 64 * 1024;  // 64KB
+
+// adaptive thread-cache sizing: how often the per-thread decay pass
+// runs, how many global refills within one interval mark a class as
+// hot (eligible to grow its attach target), and the per-thread cap on
+// bytes the attach targets may add up to
+static constexpr std::chrono::milliseconds kCacheDecayIntervalMs{1000};
+static constexpr uint32_t kCacheHotRefillThreshold = 4;
+static constexpr size_t kThreadCacheBytesBudget = 2 * 1024 * 1024;  // 2MB
+
 // shuffle vector features
 static constexpr int16_t kMaxShuffleVectorLength = 256;  // sizeof(uint8_t) << 8
 static constexpr bool kEnableShuffleOnInit = SHUFFLE_ON_INIT == 1;
@@ -116,16 +163,38 @@ static constexpr bool kAdviseDump = false;
 static constexpr std::chrono::milliseconds kZeroMs{0};
 static constexpr std::chrono::milliseconds kMeshPeriodMs{100};  // 100 ms
 
+// bounds the adaptive mesh scheduler floats the period between:
+// toward the minimum while fragmentation is climbing, toward the
+// maximum while the heap is steady.
+static constexpr std::chrono::milliseconds kMeshPeriodMinMs{10};
+static constexpr std::chrono::milliseconds kMeshPeriodMaxMs{2000};
+
+// when meshing incrementally, how long a single mesh slice may pause
+// allocating threads.  zero disables incremental mode (a mesh cycle
+// processes every size class in one stop-the-world burst).
+static constexpr std::chrono::microseconds kZeroUs{0};
+static constexpr std::chrono::microseconds kMeshPauseBudgetUs{200};  // 200 us
+
 // controls aspects of miniheaps
 static constexpr size_t kMaxMeshes = 256;  // 1 per bit
+
+// kArenaSize is the compile-time *maximum* the metadata arrays
+// (_mhIndex, the meshed/huge bitmaps, the miniheap allocator slab)
+// are sized for; they are mapped MAP_NORESERVE and committed lazily
+// by the OS as _end grows, so a big maximum only costs address space.
+// The actual reservation defaults to kDefaultArenaSize and can be set
+// at startup with MESH_ARENA_SIZE_GB (clamped to [1, kArenaSize]).
 #ifdef __APPLE__
-static constexpr size_t kArenaSize = 32ULL * 1024ULL * 1024ULL * 1024ULL;  // 16 GB
+static constexpr size_t kArenaSize = 32ULL * 1024ULL * 1024ULL * 1024ULL;         // 32 GB
+static constexpr size_t kDefaultArenaSize = 32ULL * 1024ULL * 1024ULL * 1024ULL;  // 32 GB
 #else
-static constexpr size_t kArenaSize = 64ULL * 1024ULL * 1024ULL * 1024ULL;  // 64 GB
+static constexpr size_t kArenaSize = 256ULL * 1024ULL * 1024ULL * 1024ULL;       // 256 GB
+static constexpr size_t kDefaultArenaSize = 64ULL * 1024ULL * 1024ULL * 1024ULL;  // 64 GB
 #endif
 static constexpr size_t kAltStackSize = 16 * 1024UL;  // 16k sigaltstacks
 #define SIGQUIESCE (SIGRTMIN + 7)
 #define SIGDUMP (SIGRTMIN + 8)
+#define SIGTRIM (SIGRTMIN + 9)
 
 // BinnedTracker
 static constexpr size_t kBinnedTrackerBinCount = 1;
@@ -268,6 +337,21 @@ inline time_point ATTRIBUTE_ALWAYS_INLINE now() {
   return std::chrono::high_resolution_clock::now();
 #endif
 }
+
+// unlike now() this uses the precise monotonic clock -- the coarse
+// clock's multi-millisecond granularity is useless for the
+// sub-millisecond mesh pause budget.
+inline time_point ATTRIBUTE_ALWAYS_INLINE preciseNow() {
+#ifdef __linux__
+  using namespace std::chrono;
+  struct timespec tp;
+  auto err = clock_gettime(CLOCK_MONOTONIC, &tp);
+  hard_assert(err == 0);
+  return time_point(seconds(tp.tv_sec) + nanoseconds(tp.tv_nsec));
+#else
+  return std::chrono::high_resolution_clock::now();
+#endif
+}
 }  // namespace time
 
 #define PREDICT_TRUE likely
@@ -338,7 +422,7 @@ private:
   static const int32_t class_to_size_[kClassSizesMax];
 
 public:
-  static constexpr size_t num_size_classes = 25;
+  static constexpr size_t num_size_classes = 33;
 
   // Constructor should do nothing since we rely on explicit Init()
   // call, which may or may not be called before the constructor runs.
@@ -372,6 +456,25 @@ public:
     return class_to_size_[cl];
   }
 };
+
+// the canonical size-class table, usable in constant expressions; the
+// runtime class_to_size_ array is initialized from it entry by entry
+// so the two can never diverge
+constexpr int32_t kClassSizes[kClassSizesMax] = {
+    16,    16,    32,    48,    64,    80,    96,     112,    128,    160,    192,
+    224,   256,   320,   384,   448,   512,   640,    768,    896,    1024,   2048,
+    4096,  8192,  16384, 24576, 32768, 49152, 65536,  98304,  131072, 196608, 262144,
+};
+
+// compile-time equivalent of SizeMap::GetSizeClass: the smallest
+// class that fits sz, or -1 if sz needs a page-backed allocation.
+// Class 0 is skipped, matching the generated class_array_ (it is a
+// duplicate of class 1).
+inline constexpr int classForSize(size_t sz, int cl = 1) {
+  return cl >= static_cast<int>(kClassSizesMax)
+             ? -1
+             : (sz <= static_cast<size_t>(kClassSizes[cl]) ? cl : classForSize(sz, cl + 1));
+}
 }  // namespace mesh
 
 #endif  // MESH_COMMON_H
@@ -9,6 +9,7 @@
 
 #include "meshing.h"
 #include "runtime.h"
+#include "tracepoints.h"
 
 namespace mesh {
 
@@ -27,7 +28,7 @@ MiniHeapID GetMiniHeapID(const MiniHeap *mh) {
   return runtime().heap().miniheapIDFor(mh);
 }
 
-void *GlobalHeap::malloc(size_t sz) {
+void *GlobalHeap::malloc(size_t sz, bool *zeroed) {
 #ifndef NDEBUG
   if (unlikely(sz <= kMaxSize)) {
     abort();
@@ -36,7 +37,7 @@ void *GlobalHeap::malloc(size_t sz) {
 
   const auto pageCount = PageCount(sz);
 
-  return pageAlignedAlloc(1, pageCount);
+  return pageAlignedAlloc(1, pageCount, zeroed);
 }
 
 void GlobalHeap::free(void *ptr) {
@@ -53,13 +54,16 @@ void GlobalHeap::free(void *ptr) {
   this->freeFor(mh, ptr, startEpoch);
 }
 
-void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
+// the body of freeFor, minus the maybeMesh call: returns whether the
+// caller should consider meshing, so batched frees can defer that
+// decision to once per batch.
+bool GlobalHeap::freeForInner(MiniHeap *mh, void *ptr, size_t startEpoch) {
   if (unlikely(ptr == nullptr)) {
-    return;
+    return false;
   }
 
   if (unlikely(!mh)) {
-    return;
+    return false;
   }
 
   // large objects are tracked with a miniheap per object and don't
@@ -67,9 +71,16 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
   // This can also include, for example, single page allocations w/
   // 16KB alignment.
   if (mh->isLargeAlloc()) {
-    lock_guard<mutex> lock(_miniheapLock);
+    // park hot message-buffer-sized spans in the large span cache;
+    // the background thread decays what doesn't get reused
+    if (likely(tryCacheLargeSpan(mh))) {
+      return false;
+    }
+
+    // large miniheaps never live on a size-class freelist, so the
+    // arena lock (taken inside freeMiniheapLocked) is sufficient.
     freeMiniheapLocked(mh, false);
-    return;
+    return false;
   }
 
   d_assert(mh->maxCount() > 1);
@@ -100,12 +111,12 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
   if (startEpoch % 2 == 1 || !_meshEpoch.isSame(startEpoch)) {
     // a mesh was started in between when we looked up our miniheap
     // and now.  synchronize to avoid races
-    lock_guard<mutex> lock(_miniheapLock);
+    lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
 
     const auto origMh = mh;
     mh = miniheapForWithEpoch(ptr, startEpoch);
     if (unlikely(mh == nullptr)) {
-      return;
+      return false;
     }
 
     if (unlikely(mh != origMh)) {
@@ -117,7 +128,7 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
         mh->free(arenaBegin(), ptr);
       } else {
         // our MiniHeap is unrelated to whatever is here in memory now - get out of here.
-        return;
+        return false;
       }
     }
 
@@ -127,14 +138,14 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
       //  It doesn't eliminate the problem (which should be solved
       //  by storing the 'created epoch' on the MiniHeap), but it should
       //  further reduce its probability
-      return;
+      return false;
     }
 
     remaining = mh->inUseCount();
     freelistId = mh->freelistId();
     isAttached = mh->isAttached();
 
-    if (!isAttached && (remaining == 0 || freelistId == list::Full)) {
+    if (!isAttached && needsFreelistMove(mh, freelistId, remaining)) {
       // this may free the miniheap -- we can't safely access it after
       // this point.
       const bool shouldFlush = postFreeLocked(mh, sizeClass, remaining);
@@ -148,8 +159,17 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
   } else {
     // the free went through ok; if we _were_ full, or now _are_ empty,
     // make sure to update the littleheaps
-    if (!isAttached && (remaining == 0 || freelistId == list::Full)) {
-      lock_guard<mutex> lock(_miniheapLock);
+    if (!isAttached && needsFreelistMove(mh, freelistId, remaining)) {
+      // common remote-free case: the bit is already cleared, only the
+      // freelist transition is left.  Defer it with a single CAS into
+      // the size class's stash rather than fighting for the shard; the
+      // next refill or mesh of this class applies it.
+      if (likely(_pendingFrees[sizeClass].push(miniheapIDFor(mh)))) {
+        return false;
+      }
+
+      // stash was full -- fall back to applying the transition here
+      lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
 
       // there are 2 ways we could have raced with meshing:
       //
@@ -157,7 +177,8 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
       //    above with the !_meshEpoch.isSame(current)).  this is what
       //    the outer if statement here takes care of.
       //
-      // 2. this thread losing the race with acquiring _miniheapLock
+      // 2. this thread losing the race with acquiring our size
+      //    class's lock shard
       //    (what we care about here).  for thi case, we know a) our
       //    write to the MiniHeap's bitmap succeeded (or we would be
       //    in the other side of the outer if statement), and b) our
@@ -178,7 +199,7 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
         // another thread took care of freeing this MiniHeap for us,
         // super!  nothing else to do.
         if (mh == nullptr) {
-          return;
+          return false;
         }
 
         // check to make sure the new MiniHeap is related (via a
@@ -188,7 +209,7 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
           // the original miniheap was freed and a new (unrelated)
           // Miniheap allocated for the address space.  nothing else
           // for us to do.
-          return;
+          return false;
         } else {
           // TODO: we should really store 'created epoch' on mh and
           // check those are the same here, too.
@@ -201,7 +222,7 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
         //  It doesn't eliminate the problem (which should be solved
         //  by storing the 'created epoch' on the MiniHeap), but it should
         //  further reduce its probability
-        return;
+        return false;
       }
 
       // a lot could have happened between when we read this without
@@ -216,16 +237,171 @@ void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
     }
   }
 
+  return shouldMesh;
+}
+
+void GlobalHeap::freeFor(MiniHeap *mh, void *ptr, size_t startEpoch) {
+  if (freeForInner(mh, ptr, startEpoch)) {
+    maybeMesh();
+  }
+}
+
+// batched remote frees: runs the same per-pointer logic as freeFor,
+// but considers meshing only once at the end.  Stash overflows inside
+// the loop drain the stash, so at most one lock acquisition per size
+// class is paid per batch in practice.
+void GlobalHeap::freeBatch(void *const *ptrs, size_t count) {
+  bool shouldMesh = false;
+
+  for (size_t i = 0; i < count; i++) {
+    void *ptr = ptrs[i];
+    size_t startEpoch{0};
+    auto mh = miniheapForWithEpoch(ptr, startEpoch);
+    shouldMesh |= freeForInner(mh, ptr, startEpoch);
+  }
+
+  if (shouldMesh) {
+    maybeMesh();
+  }
+}
+
+// bulk free for same-size-class teardown storms: O(distinct
+// miniheaps) bitmap and freelist operations instead of O(n).
+void GlobalHeap::freeBatchSorted(void *const *ptrs, size_t count) {
+  constexpr size_t kChunk = 256;
+
+  struct Entry {
+    MiniHeap *mh;
+    void *ptr;
+  };
+  Entry entries[kChunk];
+
+  if (_lastMeshEffective.load(std::memory_order::memory_order_acquire) == 0) {
+    _lastMeshEffective.store(1, std::memory_order::memory_order_release);
+  }
+
+  bool shouldMesh = false;
+
+  for (size_t base = 0; base < count; base += kChunk) {
+    const size_t n = std::min(kChunk, count - base);
+
+    const size_t startEpoch = _meshEpoch.current();
+    if (unlikely(startEpoch % 2 == 1)) {
+      // a mesh is in flight; the one-at-a-time path resolves races
+      for (size_t i = 0; i < n; i++) {
+        size_t epoch{0};
+        auto mh = miniheapForWithEpoch(ptrs[base + i], epoch);
+        shouldMesh |= freeForInner(mh, ptrs[base + i], epoch);
+      }
+      continue;
+    }
+
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+      void *ptr = ptrs[base + i];
+      if (unlikely(ptr == nullptr)) {
+        continue;
+      }
+      auto mh = miniheapFor(ptr);
+      if (unlikely(mh == nullptr || mh->isLargeAlloc())) {
+        shouldMesh |= freeForInner(mh, ptr, startEpoch);
+        continue;
+      }
+      entries[m].mh = mh;
+      entries[m].ptr = ptr;
+      m++;
+    }
+
+    std::sort(entries, entries + m, [](const Entry &a, const Entry &b) { return a.mh < b.mh; });
+
+    size_t i = 0;
+    while (i < m) {
+      MiniHeap *mh = entries[i].mh;
+      const int sizeClass = mh->sizeClass();
+
+      size_t masks[4] = {0, 0, 0, 0};
+      size_t j = i;
+      for (; j < m && entries[j].mh == mh; j++) {
+        const uint8_t off = mh->getOff(arenaBegin(), entries[j].ptr);
+        masks[off >> 6] |= 1ULL << (off & 63);
+      }
+
+      size_t oldBits[4];
+      mh->writableBitmap().unsetMask(masks, oldBits);
+
+      if (unlikely(!_meshEpoch.isSame(startEpoch))) {
+        // a mesh started mid-clear; resolve each pointer under the
+        // shard lock exactly as the singleton slow path would, using
+        // the old words to recover which bits our clear actually hit
+        lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
+        for (size_t k = i; k < j; k++) {
+          void *ptr = entries[k].ptr;
+          const uint8_t off = mh->getOff(arenaBegin(), ptr);
+          const bool wasSet = (oldBits[off >> 6] >> (off & 63)) & 1;
+
+          size_t epoch{0};
+          auto mhNow = miniheapForWithEpoch(ptr, epoch);
+          if (mhNow == nullptr || mhNow == mh) {
+            continue;
+          }
+          if (mhNow->isRelated(mh) && !wasSet && mhNow->sizeClass() == sizeClass && !mhNow->isLargeAlloc()) {
+            // our clear lost to the mesh's bitmap consume; free the
+            // object on the surviving miniheap
+            mhNow->free(arenaBegin(), ptr);
+          }
+        }
+        // the run's miniheap itself may have been consumed by the
+        // mesh (batch-freed miniheaps are partially empty -- prime
+        // sources); re-inserting a meshed or recycled one onto a
+        // freelist would let a flush free it out from under its
+        // keeper.  Same guard drainPendingFreesLocked uses.
+        if (!mh->isMeshed() && mh->sizeClass() == sizeClass && !mh->isLargeAlloc()) {
+          const bool shouldFlush = postFreeLocked(mh, sizeClass, mh->inUseCount());
+          if (unlikely(shouldFlush)) {
+            flushBinLocked(sizeClass);
+          }
+        }
+        i = j;
+        continue;
+      }
+
+      // common case: one classification for the whole run
+      const auto isAttached = mh->isAttached();
+      const auto freelistId = mh->freelistId();
+      const auto remaining = mh->inUseCount();
+      if (!isAttached && needsFreelistMove(mh, freelistId, remaining)) {
+        if (unlikely(!_pendingFrees[sizeClass].push(miniheapIDFor(mh)))) {
+          lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
+          drainPendingFreesLocked(sizeClass);
+          // a mesh may have consumed mh between our epoch check and
+          // taking the shard; don't re-list it if so
+          if (!mh->isMeshed() && mh->sizeClass() == sizeClass && !mh->isLargeAlloc()) {
+            const bool shouldFlush = postFreeLocked(mh, sizeClass, mh->inUseCount());
+            if (unlikely(shouldFlush)) {
+              flushBinLocked(sizeClass);
+            }
+          }
+        }
+      } else {
+        shouldMesh |= !isAttached;
+      }
+
+      i = j;
+    }
+  }
+
   if (shouldMesh) {
     maybeMesh();
   }
 }
 
 int GlobalHeap::mallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
-  unique_lock<mutex> lock(_miniheapLock);
+  lockAllShards();
 
-  if (!oldp || !oldlenp || *oldlenp < sizeof(size_t))
+  if (!oldp || !oldlenp || *oldlenp < sizeof(size_t)) {
+    unlockAllShards();
     return -1;
+  }
 
   auto statp = reinterpret_cast<size_t *>(oldp);
 
@@ -237,14 +413,11 @@ int GlobalHeap::mallctl(const char *name, void *oldp, size_t *oldlenp, void *new
     _meshPeriod = *newVal;
     // resetNextMeshCheck();
   } else if (strcmp(name, "mesh.scavenge") == 0) {
-    lock.unlock();
+    // scavenge takes the arena lock itself; no shard is needed
     scavenge(true);
-    lock.lock();
   } else if (strcmp(name, "mesh.compact") == 0) {
     meshAllSizeClassesLocked();
-    lock.unlock();
     scavenge(true);
-    lock.lock();
   } else if (strcmp(name, "arena") == 0) {
     // not sure what this should do
   } else if (strcmp(name, "stats.resident") == 0) {
@@ -275,6 +448,8 @@ int GlobalHeap::mallctl(const char *name, void *oldp, size_t *oldlenp, void *new
     }
     *statp = sz;
   }
+
+  unlockAllShards();
   return 0;
 }
 
@@ -285,25 +460,29 @@ void GlobalHeap::meshLocked(MiniHeap *dst, MiniHeap *&src) {
   const size_t dstSpanSize = dst->spanSize();
   const auto dstSpanStart = reinterpret_cast<void *>(dst->getSpanStart(arenaBegin()));
 
-  src->forEachMeshed([&](const MiniHeap *mh) {
-    // marks srcSpans read-only
-    const auto srcSpan = reinterpret_cast<void *>(mh->getSpanStart(arenaBegin()));
-    Super::beginMesh(dstSpanStart, srcSpan, dstSpanSize);
-    return false;
-  });
-
-  // does the copying of objects and updating of span metadata
-  dst->consume(arenaBegin(), src);
-  d_assert(src->isMeshed());
-
-  src->forEachMeshed([&](const MiniHeap *mh) {
-    d_assert(mh->isMeshed());
-    const auto srcSpan = reinterpret_cast<void *>(mh->getSpanStart(arenaBegin()));
-    // frees physical memory + re-marks srcSpans as read/write
-    Super::finalizeMesh(dstSpanStart, srcSpan, dstSpanSize);
-    return false;
-  });
-  Super::freePhys(reinterpret_cast<void *>(src->getSpanStart(arenaBegin())), dstSpanSize);
+  {
+    lock_guard<mutex> lock(_arenaLock);
+
+    src->forEachMeshed([&](const MiniHeap *mh) {
+      // marks srcSpans read-only
+      const auto srcSpan = reinterpret_cast<void *>(mh->getSpanStart(arenaBegin()));
+      Super::beginMesh(dstSpanStart, srcSpan, dstSpanSize);
+      return false;
+    });
+
+    // does the copying of objects and updating of span metadata
+    dst->consume(arenaBegin(), src);
+    d_assert(src->isMeshed());
+
+    src->forEachMeshed([&](const MiniHeap *mh) {
+      d_assert(mh->isMeshed());
+      const auto srcSpan = reinterpret_cast<void *>(mh->getSpanStart(arenaBegin()));
+      // frees physical memory + re-marks srcSpans as read/write
+      Super::finalizeMesh(dstSpanStart, srcSpan, dstSpanSize);
+      return false;
+    });
+    Super::freePhys(reinterpret_cast<void *>(src->getSpanStart(arenaBegin())), dstSpanSize);
+  }
 
   // make sure we adjust what bin the destination is in -- it might
   // now be full and not a candidate for meshing
@@ -311,23 +490,45 @@ void GlobalHeap::meshLocked(MiniHeap *dst, MiniHeap *&src) {
   untrackMiniheapLocked(src);
 }
 
-size_t GlobalHeap::meshSizeClassLocked(size_t sizeClass, MergeSetArray &mergeSets, SplitArray &left,
-                                       SplitArray &right) {
+size_t GlobalHeap::meshSizeClassLocked(size_t sizeClass, MergeSetArray &mergeSets, SplitArray &left, SplitArray &right,
+                                       time::time_point deadline) {
+  const ClassMeshPolicy &policy = _classMeshPolicy[sizeClass];
+  if (unlikely(!policy.enabled)) {
+    return 0;
+  }
+
   size_t mergeSetCount = 0;
   // memset(reinterpret_cast<void *>(&mergeSets), 0, sizeof(mergeSets));
   // memset(&left, 0, sizeof(left));
   // memset(&right, 0, sizeof(right));
 
+  // apply deferred remote-free transitions first, so empty miniheaps
+  // are visible to the flush below and occupancies are current for
+  // the candidate scan
+  drainPendingFreesLocked(sizeClass);
+
   auto meshFound =
       function<bool(std::pair<MiniHeap *, MiniHeap *> &&)>([&](std::pair<MiniHeap *, MiniHeap *> &&miniheaps) {
-        if (miniheaps.first->isMeshingCandidate() && miniheaps.second->isMeshingCandidate()) {
+        // the bands exclude fullness >= kOccupancyCutoff; a tighter
+        // per-class cutoff is enforced here at candidate time
+        if (miniheaps.first->isMeshingCandidate() && miniheaps.second->isMeshingCandidate() &&
+            miniheaps.first->fullness() < policy.occupancyCutoff &&
+            miniheaps.second->fullness() < policy.occupancyCutoff) {
           mergeSets[mergeSetCount] = std::move(miniheaps);
           mergeSetCount++;
         }
-        return mergeSetCount < kMaxMergeSets;
+        return mergeSetCount < policy.maxPairsPerCycle;
       });
 
-  method::shiftedSplitting(_fastPrng, &_partialFreelist[sizeClass].first, left, right, meshFound);
+  // only the bands below the occupancy cutoff can yield meshes; the
+  // index is maintained by postFreeLocked, so no O(n) filtering pass
+  // over a single partial list is needed here
+  MiniHeapListEntry *bands[kOccupancyBands - 1];
+  for (size_t band = 0; band < kOccupancyBands - 1; band++) {
+    bands[band] = &_partialFreelist[sizeClass][band].first;
+  }
+
+  method::shiftedSplitting(_meshPrng, bands, kOccupancyBands - 1, left, right, meshFound);
 
   if (mergeSetCount == 0) {
     // debug("nothing to mesh.");
@@ -337,6 +538,12 @@ size_t GlobalHeap::meshSizeClassLocked(size_t sizeClass, MergeSetArray &mergeSet
   size_t meshCount = 0;
 
   for (size_t i = 0; i < mergeSetCount; i++) {
+    // the merges (page copies + remaps) dominate the cost of a mesh
+    // cycle, so this is where the pause budget is enforced
+    if (unlikely(time::preciseNow() >= deadline)) {
+      break;
+    }
+
     std::pair<MiniHeap *, MiniHeap *> &mergeSet = mergeSets[i];
     MiniHeap *dst = mergeSet.first;
     MiniHeap *src = mergeSet.second;
@@ -371,6 +578,7 @@ size_t GlobalHeap::meshSizeClassLocked(size_t sizeClass, MergeSetArray &mergeSet
     if (!oneEmpty && !aboveMeshThreshold()) {
       meshLocked(dst, src);
       meshCount++;
+      _stats.classMeshedPages[sizeClass] += dst->spanSize() / kPageSize;
     }
   }
 
@@ -381,22 +589,33 @@ size_t GlobalHeap::meshSizeClassLocked(size_t sizeClass, MergeSetArray &mergeSet
   return meshCount;
 }
 
+// scratch space for the mesh scan, shared by the full and incremental
+// cycles (both run with every shard held).  Page aligned so we can
+// MADV_DONTNEED it between cycles.
+static MergeSetArray PAGE_ALIGNED MergeSets;
+static_assert(sizeof(MergeSets) == sizeof(void *) * 2 * 4096, "array too big");
+
+static SplitArray PAGE_ALIGNED Left;
+static SplitArray PAGE_ALIGNED Right;
+static_assert(sizeof(Left) == sizeof(void *) * 16384, "array too big");
+static_assert(sizeof(Right) == sizeof(void *) * 16384, "array too big");
+
 void GlobalHeap::meshAllSizeClassesLocked() {
-  static MergeSetArray PAGE_ALIGNED MergeSets;
-  static_assert(sizeof(MergeSets) == sizeof(void *) * 2 * 4096, "array too big");
   d_assert((reinterpret_cast<uintptr_t>(&MergeSets) & (kPageSize - 1)) == 0);
-
-  static SplitArray PAGE_ALIGNED Left;
-  static SplitArray PAGE_ALIGNED Right;
-  static_assert(sizeof(Left) == sizeof(void *) * 16384, "array too big");
-  static_assert(sizeof(Right) == sizeof(void *) * 16384, "array too big");
   d_assert((reinterpret_cast<uintptr_t>(&Left) & (kPageSize - 1)) == 0);
   d_assert((reinterpret_cast<uintptr_t>(&Right) & (kPageSize - 1)) == 0);
 
+  // mesh cycles are the decay clock for the large span cache in the
+  // default (no background thread) configuration
+  trimLargeSpanCache();
+
   // if we have freed but not reset meshed mappings, this will reset
   // them to the identity mapping, ensuring we don't blow past our VMA
   // limit (which is why we set the force flag to true)
-  Super::scavenge(true);
+  {
+    lock_guard<mutex> lock(_arenaLock);
+    Super::scavenge(true);
+  }
 
   if (!_lastMeshEffective.load(std::memory_order::memory_order_acquire)) {
     return;
@@ -407,8 +626,7 @@ void GlobalHeap::meshAllSizeClassesLocked() {
   }
 
   lock_guard<EpochLock> epochLock(_meshEpoch);
-
-  // const auto start = time::now();
+  const auto epochStart = time::preciseNow();
 
   // first, clear out any free memory we might have
   for (size_t sizeClass = 0; sizeClass < kNumBins; sizeClass++) {
@@ -428,19 +646,106 @@ void GlobalHeap::meshAllSizeClassesLocked() {
   _lastMeshEffective = totalMeshCount > 256;
   _stats.meshCount += totalMeshCount;
 
-  Super::scavenge(true);
+  {
+    lock_guard<mutex> lock(_arenaLock);
+    Super::scavenge(true);
+  }
+
+  adaptMeshPeriodLocked(totalMeshCount);
 
   _lastMesh = time::now();
 
-  // const std::chrono::duration<double> duration = _lastMesh - start;
-  // debug("mesh took %f, found %zu", duration.count(), totalMeshCount);
+  MESH_PROBE2(mesh_epoch_held, chrono::duration_cast<chrono::nanoseconds>(time::preciseNow() - epochStart).count(),
+              totalMeshCount);
+}
+
+void GlobalHeap::adaptMeshPeriodLocked(size_t meshCount) {
+  if (!_adaptiveMeshPeriod) {
+    return;
+  }
+
+  // the lock-free internal estimate is plenty for a trend signal and
+  // avoids a smaps parse on every mesh cycle
+  const size_t rssKb = Super::rssKbEstimate();
+  // climbing if this cycle actually reclaimed something, or if RSS
+  // has grown noticeably (>~1.5%) since the last cycle even though
+  // meshing found nothing -- fragmentation is outpacing us
+  const bool climbing = meshCount > 0 || rssKb > _lastCycleRssKb + (_lastCycleRssKb >> 6);
+  _lastCycleRssKb = rssKb;
+
+  if (climbing) {
+    _meshPeriodMs = std::max(_meshPeriodMinMs, _meshPeriodMs / 2);
+  } else {
+    _meshPeriodMs = std::min(_meshPeriodMaxMs, _meshPeriodMs * 2);
+  }
+}
+
+void GlobalHeap::meshSizeClassesIncrementalLocked() {
+  trimLargeSpanCache();
+
+  if (!_lastMeshEffective.load(std::memory_order::memory_order_acquire)) {
+    return;
+  }
+
+  if (Super::aboveMeshThreshold()) {
+    // over budget: spend this slice un-meshing (the scavenge restores
+    // identity mappings, giving VMAs back) instead of meshing more
+    lock_guard<mutex> lock(_arenaLock);
+    Super::scavenge(true);
+    return;
+  }
+
+  lock_guard<EpochLock> epochLock(_meshEpoch);
+  const auto epochStart = time::preciseNow();
+
+  const auto deadline = epochStart + _meshPauseBudget;
+
+  size_t totalMeshCount = 0;
+  size_t classesVisited = 0;
+  bool wrapped = false;
+
+  while (classesVisited < kNumBins) {
+    const size_t sizeClass = _meshCursor;
+    _meshCursor++;
+    if (_meshCursor == kNumBins) {
+      _meshCursor = 0;
+      wrapped = true;
+    }
+    classesVisited++;
+
+    flushBinLocked(sizeClass);
+    totalMeshCount += meshSizeClassLocked(sizeClass, MergeSets, Left, Right, deadline);
+
+    if (time::preciseNow() >= deadline) {
+      break;
+    }
+  }
+
+  // a sweep that visited every size class without finding anything
+  // gives the same signal the full cycle uses to throttle itself;
+  // partial sweeps keep meshing on the next invocation.
+  if (wrapped && classesVisited == kNumBins) {
+    _lastMeshEffective = totalMeshCount > 256;
+    adaptMeshPeriodLocked(totalMeshCount);
+  }
+  _stats.meshCount += totalMeshCount;
+
+  // restoring identity mappings (and the fallocate hole punching for
+  // freed physical pages) is deferred until a sweep completes, rather
+  // than paid in every slice.
+  if (wrapped) {
+    lock_guard<mutex> lock(_arenaLock);
+    Super::scavenge(true);
+  }
+
+  _lastMesh = time::now();
 }
 
 void GlobalHeap::dumpStats(int level, bool beDetailed) const {
   if (level < 1)
     return;
 
-  lock_guard<mutex> lock(_miniheapLock);
+  lock_guard<mutex> lock(_arenaLock);
 
   const auto meshedPageHWM = meshedPageHighWaterMark();
 
@@ -450,6 +755,7 @@ void GlobalHeap::dumpStats(int level, bool beDetailed) const {
   debug("Meshed MB HWM:      %.1f\n", meshedPageHWM * 4096.0 / 1024.0 / 1024.0);
   // debug("Peak RSS reduction: %.2f\n", rssSavings);
   debug("MH Alloc Count:     %zu\n", (size_t)_stats.mhAllocCount);
+  debug("MH Pinned Count:    %zu\n", (size_t)_stats.mhPinnedCount);
   debug("MH Free  Count:     %zu\n", (size_t)_stats.mhFreeCount);
   debug("MH High Water Mark: %zu\n", (size_t)_stats.mhHighWaterMark);
   if (level > 1) {
@@ -461,25 +767,246 @@ void GlobalHeap::dumpStats(int level, bool beDetailed) const {
 
 namespace method {
 
-void ATTRIBUTE_NEVER_INLINE halfSplit(MWC &prng, MiniHeapListEntry *miniheaps, SplitArray &left, size_t &leftSize,
-                                      SplitArray &right, size_t &rightSize) noexcept {
+// A small pool of helper threads for the mesh candidate scan.  The
+// probes are read-only, independent bitmap comparisons; workers pull
+// left-side indices from a shared cursor (cheap work stealing) and
+// record candidate pairs, which the coordinator then funnels to
+// meshFound single-threaded so the consume/nullify bookkeeping stays
+// sequential.  Workers never allocate, so it is safe for them to run
+// while the mesh cycle holds every heap lock.
+class MeshScanPool {
+public:
+  static constexpr size_t kMaxWorkers = 4;
+
+  struct Candidate {
+    uint32_t leftIdx;
+    uint32_t rightIdx;
+  };
+
+  // spawn worker threads; must be called without heap locks held.
+  // Calling it again (e.g. after fork, when the children are gone)
+  // respawns.
+  void start(size_t workerCount) {
+    if (workerCount > kMaxWorkers) {
+      workerCount = kMaxWorkers;
+    }
+
+    lock_guard<mutex> lock(_mu);
+
+    if (_pid != getpid()) {
+      // post-fork: the threads died with the parent's address space
+      _startedWorkers = 0;
+      _pendingWorkers = 0;
+    }
+    _pid = getpid();
+
+    while (_startedWorkers < workerCount) {
+      pthread_t t;
+      if (mesh::real::pthread_create == nullptr) {
+        mesh::real::init();
+      }
+      WorkerArgs *args = reinterpret_cast<WorkerArgs *>(internal::Heap().malloc(sizeof(WorkerArgs)));
+      args->pool = this;
+      args->slot = _startedWorkers;
+      if (mesh::real::pthread_create(&t, nullptr, MeshScanPool::workerEntry, args) != 0) {
+        internal::Heap().free(args);
+        break;
+      }
+      pthread_detach(t);
+      _startedWorkers++;
+    }
+  }
+
+  // whether scans should go parallel right now.  After a fork the
+  // workers no longer exist, so children fall back to the sequential
+  // scan until start() is called again.
+  inline bool active() const {
+    return _startedWorkers > 0 && _pid == getpid();
+  }
+
+  // run the probe phase over [0, leftSize) across the workers plus
+  // the calling thread; results remain valid until the next scan
+  void scan(SplitArray &left, size_t leftSize, SplitArray &right, size_t rightSize, size_t limit) {
+    _left = &left;
+    _leftSize = leftSize;
+    _right = &right;
+    _rightSize = rightSize;
+    _limit = limit;
+    _nextLeft.store(0, std::memory_order_relaxed);
+
+    size_t workers;
+    {
+      lock_guard<mutex> lock(_mu);
+      workers = _startedWorkers;
+      _pendingWorkers = workers;
+      _generation++;
+    }
+    _cv.notify_all();
+
+    // the coordinator scans too, using the slot past the workers'
+    probeRange(workers);
+
+    unique_lock<mutex> lock(_mu);
+    while (_pendingWorkers > 0) {
+      _doneCv.wait(lock);
+    }
+  }
+
+  inline size_t slotCount() const {
+    return _startedWorkers + 1;
+  }
+
+  inline size_t candidateCount(size_t slot) const {
+    return _candidateCounts[slot];
+  }
+
+  inline const Candidate *candidates(size_t slot) const {
+    return _candidates[slot];
+  }
+
+private:
+  struct WorkerArgs {
+    MeshScanPool *pool;
+    size_t slot;
+  };
+
+  static void *workerEntry(void *arg) {
+    WorkerArgs *args = reinterpret_cast<WorkerArgs *>(arg);
+    MeshScanPool *pool = args->pool;
+    const size_t slot = args->slot;
+    internal::Heap().free(args);
+    pool->workerLoop(slot);
+    return nullptr;
+  }
+
+  void workerLoop(size_t slot) {
+    uint64_t seenGeneration = 0;
+    for (;;) {
+      {
+        unique_lock<mutex> lock(_mu);
+        while (_generation == seenGeneration) {
+          _cv.wait(lock);
+        }
+        seenGeneration = _generation;
+      }
+
+      probeRange(slot);
+
+      {
+        lock_guard<mutex> lock(_mu);
+        _pendingWorkers--;
+        if (_pendingWorkers == 0) {
+          _doneCv.notify_all();
+        }
+      }
+    }
+  }
+
+  void probeRange(size_t slot) {
+    constexpr size_t nBytes = 32;
+
+    size_t count = 0;
+    const Bitmap::word_t *rightBitmaps[kMaxMeshableBatchSize];
+    uint32_t rightIdx[kMaxMeshableBatchSize];
+
+    for (;;) {
+      const size_t j = _nextLeft.fetch_add(1, std::memory_order_relaxed);
+      if (j >= _leftSize || count == kMaxMergeSets) {
+        break;
+      }
+
+      auto h1 = (*_left)[j];
+      if (h1 == nullptr) {
+        continue;
+      }
+
+      size_t gathered = 0;
+      size_t idxRight = j;
+      for (size_t i = 0; i < _limit; i++, idxRight++) {
+        if (unlikely(idxRight >= _rightSize)) {
+          idxRight %= _rightSize;
+        }
+        auto h2 = (*_right)[idxRight];
+        if (h2 == nullptr) {
+          continue;
+        }
+        rightBitmaps[gathered] = h2->bitmap().bits();
+        rightIdx[gathered] = static_cast<uint32_t>(idxRight);
+        gathered++;
+      }
+
+      if (gathered == 0) {
+        continue;
+      }
+
+      const uint64_t meshable = mesh::bitmapsMeshableBatch(h1->bitmap().bits(), rightBitmaps, gathered, nBytes);
+      if (meshable != 0) {
+        // one candidate per left, as in the sequential scan
+        const size_t i = __builtin_ctzll(meshable);
+        _candidates[slot][count] = Candidate{static_cast<uint32_t>(j), rightIdx[i]};
+        count++;
+      }
+    }
+
+    _candidateCounts[slot] = count;
+  }
+
+  SplitArray *_left{nullptr};
+  SplitArray *_right{nullptr};
+  size_t _leftSize{0};
+  size_t _rightSize{0};
+  size_t _limit{0};
+  atomic_size_t _nextLeft{0};
+
+  Candidate _candidates[kMaxWorkers + 1][kMaxMergeSets];
+  size_t _candidateCounts[kMaxWorkers + 1]{};
+
+  mutex _mu{};
+  condition_variable _cv{};
+  condition_variable _doneCv{};
+  uint64_t _generation{0};
+  size_t _pendingWorkers{0};
+  size_t _startedWorkers{0};
+  pid_t _pid{0};
+};
+
+static MeshScanPool *meshScanPool() {
+  // avoid a static destructor; worker threads may outlive atexit
+  static char buf[sizeof(MeshScanPool)] ATTRIBUTE_ALIGNED(CACHELINE_SIZE);
+  static MeshScanPool *pool = new (buf) MeshScanPool();
+  return pool;
+}
+
+void setMeshScanWorkers(size_t n) {
+  if (n > 0) {
+    meshScanPool()->start(n);
+  }
+}
+
+void ATTRIBUTE_NEVER_INLINE halfSplit(MWC &prng, MiniHeapListEntry *const *miniheapBands, size_t bandCount,
+                                      SplitArray &left, size_t &leftSize, SplitArray &right,
+                                      size_t &rightSize) noexcept {
   d_assert(leftSize == 0);
   d_assert(rightSize == 0);
-  MiniHeapID mhId = miniheaps->next();
-  while (mhId != list::Head && leftSize < kMaxSplitListSize && rightSize < kMaxSplitListSize) {
-    auto mh = GetMiniHeap(mhId);
-    mhId = mh->getFreelist()->next();
 
-    if (!mh->isMeshingCandidate() || (mh->fullness() >= kOccupancyCutoff)) {
-      continue;
-    }
+  for (size_t band = 0; band < bandCount; band++) {
+    MiniHeapID mhId = miniheapBands[band]->next();
+    while (mhId != list::Head && leftSize < kMaxSplitListSize && rightSize < kMaxSplitListSize) {
+      auto mh = GetMiniHeap(mhId);
+      mhId = mh->getFreelist()->next();
 
-    if (leftSize <= rightSize) {
-      left[leftSize] = mh;
-      leftSize++;
-    } else {
-      right[rightSize] = mh;
-      rightSize++;
+      // band membership already guarantees fullness < kOccupancyCutoff
+      if (!mh->isMeshingCandidate()) {
+        continue;
+      }
+
+      if (leftSize <= rightSize) {
+        left[leftSize] = mh;
+        leftSize++;
+      } else {
+        right[rightSize] = mh;
+        rightSize++;
+      }
     }
   }
 
@@ -488,57 +1015,119 @@ void ATTRIBUTE_NEVER_INLINE halfSplit(MWC &prng, MiniHeapListEntry *miniheaps, S
 }
 
 void ATTRIBUTE_NEVER_INLINE
-shiftedSplitting(MWC &prng, MiniHeapListEntry *miniheaps, SplitArray &left, SplitArray &right,
-                 const function<bool(std::pair<MiniHeap *, MiniHeap *> &&)> &meshFound) noexcept {
+shiftedSplitting(MWC &prng, MiniHeapListEntry *const *miniheapBands, size_t bandCount, SplitArray &left,
+                 SplitArray &right, const function<bool(std::pair<MiniHeap *, MiniHeap *> &&)> &meshFound) noexcept {
   constexpr size_t t = 64;
 
-  if (miniheaps->empty()) {
+  bool allEmpty = true;
+  for (size_t band = 0; band < bandCount; band++) {
+    if (!miniheapBands[band]->empty() && miniheapBands[band]->next() != list::Head) {
+      allEmpty = false;
+      break;
+    }
+  }
+  if (allEmpty) {
     return;
   }
 
   size_t leftSize = 0;
   size_t rightSize = 0;
 
-  halfSplit(prng, miniheaps, left, leftSize, right, rightSize);
+  halfSplit(prng, miniheapBands, bandCount, left, leftSize, right, rightSize);
 
   if (leftSize == 0 || rightSize == 0) {
     return;
   }
 
   constexpr size_t nBytes = 32;
+  static_assert(t <= kMaxMeshableBatchSize, "window must fit in one batched meshability test");
   const size_t limit = rightSize < t ? rightSize : t;
   d_assert(nBytes == left[0]->bitmap().byteCount());
 
+  auto pool = meshScanPool();
+  if (pool->active()) {
+    pool->scan(left, leftSize, right, rightSize, limit);
+
+    // funnel the workers' candidates to meshFound sequentially.  Two
+    // workers may have proposed the same right-side miniheap; the
+    // null checks below drop the loser.  No re-probe is needed: bits
+    // only ever clear concurrently, so a meshable pair stays meshable.
+    size_t parallelFound = 0;
+    for (size_t slot = 0; slot < pool->slotCount(); slot++) {
+      const auto candidates = pool->candidates(slot);
+      const size_t count = pool->candidateCount(slot);
+      for (size_t k = 0; k < count; k++) {
+        auto h1 = left[candidates[k].leftIdx];
+        auto h2 = right[candidates[k].rightIdx];
+        if (h1 == nullptr || h2 == nullptr) {
+          continue;
+        }
+
+        std::pair<MiniHeap *, MiniHeap *> heaps{h1, h2};
+        bool shouldContinue = meshFound(std::move(heaps));
+        left[candidates[k].leftIdx] = nullptr;
+        right[candidates[k].rightIdx] = nullptr;
+        parallelFound++;
+        if (unlikely(parallelFound > kMaxMeshesPerIteration || !shouldContinue)) {
+          return;
+        }
+      }
+    }
+    return;
+  }
+
+  // gathered per-left-candidate so that the batched kernel can stream
+  // the right-side bitmaps against a single load of the left bitmap.
+  const Bitmap::word_t *rightBitmaps[t];
+  size_t rightIdx[t];
+
   size_t foundCount = 0;
   for (size_t j = 0; j < leftSize; j++) {
-    const size_t idxLeft = j;
-    size_t idxRight = j;
+    auto h1 = left[j];
+    if (h1 == nullptr) {
+      continue;
+    }
 
+    size_t count = 0;
+    size_t idxRight = j;
     for (size_t i = 0; i < limit; i++, idxRight++) {
       if (unlikely(idxRight >= rightSize)) {
         idxRight %= rightSize;
       }
-      auto h1 = left[idxLeft];
       auto h2 = right[idxRight];
-
-      if (h1 == nullptr || h2 == nullptr)
+      if (h2 == nullptr) {
         continue;
+      }
 
-      const auto bitmap1 = h1->bitmap().bits();
-      const auto bitmap2 = h2->bitmap().bits();
+      rightBitmaps[count] = h2->bitmap().bits();
+      rightIdx[count] = idxRight;
+      count++;
+    }
 
-      const bool areMeshable = mesh::bitmapsMeshable(bitmap1, bitmap2, nBytes);
+    if (count == 0) {
+      continue;
+    }
 
-      if (unlikely(areMeshable)) {
-        std::pair<MiniHeap *, MiniHeap *> heaps{h1, h2};
-        bool shouldContinue = meshFound(std::move(heaps));
-        left[idxLeft] = nullptr;
-        right[idxRight] = nullptr;
-        foundCount++;
-        if (unlikely(foundCount > kMaxMeshesPerIteration || !shouldContinue)) {
-          return;
-        }
+    uint64_t meshable = mesh::bitmapsMeshableBatch(h1->bitmap().bits(), rightBitmaps, count, nBytes);
+
+    while (unlikely(meshable != 0)) {
+      const size_t i = __builtin_ctzll(meshable);
+      meshable &= meshable - 1;
+
+      auto h2 = right[rightIdx[i]];
+      d_assert(h2 != nullptr);
+
+      std::pair<MiniHeap *, MiniHeap *> heaps{h1, h2};
+      bool shouldContinue = meshFound(std::move(heaps));
+      left[j] = nullptr;
+      right[rightIdx[i]] = nullptr;
+      foundCount++;
+      if (unlikely(foundCount > kMaxMeshesPerIteration || !shouldContinue)) {
+        return;
       }
+      // each left-side miniheap is consumed by its first mesh; move on
+      // to the next one.
+      break;
     }
   }
 }
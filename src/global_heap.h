@@ -14,6 +14,7 @@
 #include "internal.h"
 #include "meshable_arena.h"
 #include "mini_heap.h"
+#include "plasma/mesh.h"
 
 #include "heaplayers.h"
 
@@ -65,6 +66,61 @@ public:
   size_t mhFreeCount;
   size_t mhAllocCount;
   size_t mhHighWaterMark;
+  size_t mhPinnedCount{0};
+  // pages reclaimed by meshing, per size class
+  size_t classMeshedPages[kNumBins]{};
+};
+
+// runtime-tunable per-size-class meshing policy; defaults reproduce
+// the historical behavior exactly
+struct ClassMeshPolicy {
+  bool enabled{true};
+  double occupancyCutoff{kOccupancyCutoff};
+  size_t maxPairsPerCycle{kMaxMergeSets};
+};
+
+// a small lock-free MPSC stash of miniheaps whose freelist transition
+// has been deferred.  Remote frees CAS a miniheap ID into a slot
+// instead of taking the size class's lock shard; the next thread to
+// hold that shard (a refill or the mesher) drains it.  Pushing the
+// same miniheap more than once is fine -- postFreeLocked is
+// idempotent.  When the stash is full, pushers fall back to taking
+// the lock, so nothing is ever lost.
+class PendingFreeStash {
+public:
+  static constexpr size_t kSlots = 64;
+
+  inline bool ATTRIBUTE_ALWAYS_INLINE push(MiniHeapID id) noexcept {
+    d_assert(id.hasValue());
+
+    for (size_t i = 0; i < kSlots; i++) {
+      if (_slots[i].load(std::memory_order_relaxed) != 0) {
+        continue;
+      }
+      uint32_t expected = 0;
+      if (_slots[i].compare_exchange_strong(expected, id.value(), std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // must be called with the size class's lock shard held
+  inline MiniHeapID pop() noexcept {
+    for (size_t i = 0; i < kSlots; i++) {
+      const uint32_t val = _slots[i].exchange(0, std::memory_order_acquire);
+      if (val != 0) {
+        return MiniHeapID{val};
+      }
+    }
+
+    return MiniHeapID{};
+  }
+
+private:
+  std::array<atomic<uint32_t>, kSlots> _slots{};
 };
 
 class GlobalHeap : public MeshableArena {
@@ -79,42 +135,401 @@ public:
   enum { Alignment = 16 };
 
   GlobalHeap() : Super(), _maxObjectSize(SizeMap::ByteSizeForClass(kNumBins - 1)), _lastMesh{time::now()} {
+    // too many list heads for braced initializers; link every list
+    // to itself
+    for (size_t i = 0; i < kNumBins; i++) {
+      _emptyFreelist[i] = Head;
+      _fullList[i] = Head;
+      for (size_t band = 0; band < kOccupancyBands; band++) {
+        _partialFreelist[i][band] = Head;
+      }
+    }
+  }
+
+  // whether a free that left `remaining` objects in use requires a
+  // freelist move: leaving the Full list, becoming empty, or crossing
+  // an occupancy band within Partial.  The band case matters for the
+  // mesh scan: a miniheap that left the Full list lands in the top
+  // (never-scanned) band, and without re-banding on later frees the
+  // canonical filled-then-drained mesh candidates would sit there,
+  // invisible, until a refill happened to re-attach them.
+  inline bool needsFreelistMove(const MiniHeap *mh, uint8_t freelistId, size_t remaining) const {
+    if (remaining == 0 || freelistId == list::Full) {
+      return true;
+    }
+    return freelistId == list::Partial && occupancyBandFor(remaining, mh->maxCount()) != mh->occupancyBand();
+  }
+
+  // the band a partially-full miniheap belongs on, given its current
+  // occupancy.  The top band corresponds to fullness >= kOccupancyCutoff.
+  static inline uint32_t occupancyBandFor(size_t inUse, size_t max) {
+    if (inUse * 4 < max) {
+      return 0;
+    }
+    if (inUse * 2 < max) {
+      return 1;
+    }
+    if (inUse * 5 < max * 4) {
+      return 2;
+    }
+    return kOccupancyBands - 1;
   }
 
   inline void dumpStrings() const {
-    lock_guard<mutex> lock(_miniheapLock);
+    lockAllShards();
 
     mesh::debug("TODO: reimplement printOccupancy\n");
     // for (size_t i = 0; i < kNumBins; i++) {
     //   _littleheaps[i].printOccupancy();
     // }
+
+    unlockAllShards();
   }
 
   inline void flushAllBins() {
     for (size_t sizeClass = 0; sizeClass < kNumBins; sizeClass++) {
+      lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
       flushBinLocked(sizeClass);
     }
   }
 
   void scavenge(bool force = false) {
-    lock_guard<mutex> lock(_miniheapLock);
+    // decay unreused cached large spans first (this takes the arena
+    // lock internally per span), so the scavenge below can actually
+    // madvise them away
+    trimLargeSpanCache();
+
+    lock_guard<mutex> lock(_arenaLock);
 
     Super::scavenge(force);
   }
 
+  // --- large span cache ---------------------------------------------
+  //
+  // message-buffer workloads allocate and free 32KB-1MB spans in a
+  // tight loop; caching the freed miniheap whole (still tracked in
+  // the arena index, bitmap intact) turns that loop into a couple of
+  // CAS operations.  Decay runs wherever scavenging runs -- the mesh
+  // cycles and explicit scavenges that every default-configured
+  // process performs, plus the background thread when enabled: a
+  // bucket that saw no reuse between two passes gives a span back to
+  // the arena, where the normal PageType/dirty accounting takes over.
+
+  struct LargeSpanBucket {
+    atomic<uint32_t> lock{0};
+    uint32_t count{0};
+    bool active{false};  // reused since the last decay pass?
+    MiniHeap *spans[kLargeSpanCacheDepth];
+  };
+
+  static constexpr size_t kLargeSpanBuckets = kMaxFastLargeSize / kPageSize;
+
+  inline bool tryCacheLargeSpan(MiniHeap *mh) {
+    // without meshing there are no mesh cycles to decay the cache, so
+    // don't retain anything (this is a compile-time constant)
+    if (!kMeshingEnabled) {
+      return false;
+    }
+
+    const size_t pageCount = mh->span().length;
+    if (pageCount == 0 || pageCount > kLargeSpanBuckets) {
+      return false;
+    }
+
+    LargeSpanBucket &bucket = _largeSpanCache[pageCount - 1];
+
+    uint32_t expected = 0;
+    while (!bucket.lock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+      expected = 0;
+    }
+
+    if (bucket.count == kLargeSpanCacheDepth) {
+      bucket.lock.store(0, std::memory_order_release);
+      return false;
+    }
+
+    bucket.spans[bucket.count] = mh;
+    bucket.count++;
+    bucket.lock.store(0, std::memory_order_release);
+    return true;
+  }
+
+  inline MiniHeap *popLargeSpan(size_t pageCount) {
+    LargeSpanBucket &bucket = _largeSpanCache[pageCount - 1];
+
+    // peek without the lock; empty buckets are the common case for
+    // most sizes
+    if (bucket.count == 0) {
+      return nullptr;
+    }
+
+    uint32_t expected = 0;
+    while (!bucket.lock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+      expected = 0;
+    }
+
+    MiniHeap *mh = nullptr;
+    if (bucket.count > 0) {
+      bucket.count--;
+      mh = bucket.spans[bucket.count];
+      bucket.active = true;
+    }
+
+    bucket.lock.store(0, std::memory_order_release);
+    return mh;
+  }
+
+  // fork children reset the bucket spinlocks: a lock holder may have
+  // died with the parent.  Torn push/pop state degrades to a leaked
+  // span at worst (count is only bumped after the slot is written).
+  void resetLargeSpanCacheLocksAfterFork() {
+    for (size_t i = 0; i < kLargeSpanBuckets; i++) {
+      _largeSpanCache[i].lock.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // decay one span from each bucket that went unused since the last
+  // pass; called from the background thread
+  void trimLargeSpanCache() {
+    for (size_t i = 0; i < kLargeSpanBuckets; i++) {
+      LargeSpanBucket &bucket = _largeSpanCache[i];
+      if (bucket.count == 0 && !bucket.active) {
+        continue;
+      }
+
+      MiniHeap *victim = nullptr;
+
+      uint32_t expected = 0;
+      while (!bucket.lock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+        expected = 0;
+      }
+      if (!bucket.active && bucket.count > 0) {
+        bucket.count--;
+        victim = bucket.spans[bucket.count];
+      }
+      bucket.active = false;
+      bucket.lock.store(0, std::memory_order_release);
+
+      if (victim != nullptr) {
+        // large miniheaps only need the arena lock, taken inside
+        freeMiniheapLocked(victim, false);
+      }
+    }
+  }
+  // ------------------------------------------------------------------
+
+  // called periodically from the background thread.  Releases dirty
+  // pages in bounded batches so allocating threads never eat a full
+  // scavenge's worth of madvise calls while waiting on the arena lock.
+  void backgroundScavenge() {
+    trimLargeSpanCache();
+
+    lock_guard<mutex> lock(_arenaLock);
+
+    if (Super::dirtyPageCount() < kMinDirtyPageThreshold) {
+      return;
+    }
+
+    Super::scavengeBatch(kScavengeBatchPages);
+  }
+
   void dumpStats(int level, bool beDetailed) const;
 
-  // must be called with exclusive _mhRWLock held
+  // release every span in the large-span cache back to the arena
+  void drainLargeSpanCache() {
+    for (size_t i = 0; i < kLargeSpanBuckets; i++) {
+      for (;;) {
+        MiniHeap *victim = popLargeSpan(i + 1);
+        if (victim == nullptr) {
+          break;
+        }
+        freeMiniheapLocked(victim, false);
+      }
+    }
+  }
+
+  // aggressive reclamation for containers closing in on memory.max:
+  // run the whole pipeline -- flush empty bins, drain the large span
+  // cache, force a mesh cycle, then a full scavenge (which resets
+  // _toReset and madvises all dirty spans) -- until the internal RSS
+  // estimate meets targetKb (0 = as low as possible) or a round makes
+  // no progress.  Returns pages released by the estimate's reckoning.
+  size_t trim(size_t targetKb) {
+    constexpr int kMaxRounds = 8;
+    size_t releasedKb = 0;
+
+    for (int round = 0; round < kMaxRounds; round++) {
+      const size_t beforeKb = Super::rssKbEstimate();
+      if (targetKb != 0 && beforeKb <= targetKb) {
+        break;
+      }
+
+      flushAllBins();
+      drainLargeSpanCache();
+
+      lockAllShards();
+      meshAllSizeClassesLocked();
+      unlockAllShards();
+
+      // clean spans hold no RSS by construction (their backing was
+      // released when they became clean), so the scavenge's dirty
+      // drain + identity resets are the last word
+      scavenge(true);
+
+      const size_t afterKb = Super::rssKbEstimate();
+      if (afterKb >= beforeKb) {
+        break;
+      }
+      releasedKb += beforeKb - afterKb;
+    }
+
+    return releasedKb / (kPageSize / 1024);
+  }
+
+  // set the meshing policy for one size class; values are clamped to
+  // what the candidate index can honor (the cutoff tops out at the
+  // band ceiling, kOccupancyCutoff)
+  int setClassMeshPolicy(uint32_t sizeClass, bool enabled, double cutoff, size_t maxPairs) {
+    if (sizeClass >= static_cast<uint32_t>(kNumBins)) {
+      return -1;
+    }
+    if (cutoff < 0.0 || cutoff > 1.0) {
+      return -1;
+    }
+
+    lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
+
+    ClassMeshPolicy &policy = _classMeshPolicy[sizeClass];
+    policy.enabled = enabled;
+    policy.occupancyCutoff = cutoff == 0.0 ? kOccupancyCutoff : std::min(cutoff, kOccupancyCutoff);
+    policy.maxPairsPerCycle = maxPairs == 0 ? kMaxMergeSets : std::min(maxPairs, kMaxMergeSets);
+    return 0;
+  }
+
+  // quiesce and write a warm-restart snapshot; see
+  // MeshableArena::snapshotToDir.  Returns 0 on success.
+  int snapshot(const char *dir) {
+    lock();
+    const int result = Super::snapshotToDir(dir);
+    unlock();
+    return result;
+  }
+
+  // second phase of a snapshot restore: the arena constructor mapped
+  // everything back in, but the restored miniheaps reference dead
+  // threads and the previous process's (unpersisted) freelist heads.
+  // The arena walks the index, rebuilding the free-span sets and
+  // handing us each live miniheap to reset and re-sort onto the right
+  // list.  Called once from libmesh_init.
+  void completeSnapshotRestore() {
+    if (!Super::restorePending()) {
+      return;
+    }
+    Super::clearRestorePending();
+
+    lock();
+
+    Super::completeRestoreWalk([&](MiniHeap *mh) {
+      // the owning thread died with the old process, and the old
+      // freelist heads were never persisted
+      mh->unsetAttached();
+      mh->setFreelistId(list::Attached);
+      *mh->getFreelist() = MiniHeapListEntry{};
+
+      _miniheapCount++;
+      _stats.mhAllocCount++;
+
+      if (!mh->isLargeAlloc()) {
+        postFreeLocked(mh, mh->sizeClass(), mh->inUseCount());
+      }
+    });
+
+    _stats.mhHighWaterMark = _miniheapCount;
+
+    unlock();
+  }
+
+  // exempt the miniheap backing ptr from mesh candidate selection (or
+  // re-admit it).  Serialized on the class's lock shard so the pinned
+  // count stays exact; returns 0 on success, -1 for unknown pointers.
+  int pin(void *ptr, bool pinned) {
+    auto mh = miniheapFor(ptr);
+    if (unlikely(mh == nullptr)) {
+      return -1;
+    }
+
+    if (mh->isLargeAlloc()) {
+      // large allocations are never meshed; pinning is a no-op
+      return 0;
+    }
+
+    lock_guard<mutex> lock(_miniheapLocks[mh->sizeClass()]);
+
+    mh = miniheapFor(ptr);
+    if (unlikely(mh == nullptr)) {
+      return -1;
+    }
+
+    if (pinned && !mh->isPinned()) {
+      mh->pin();
+      _stats.mhPinnedCount++;
+    } else if (!pinned && mh->isPinned()) {
+      mh->unpin();
+      d_assert(_stats.mhPinnedCount > 0);
+      _stats.mhPinnedCount--;
+    }
+
+    return 0;
+  }
+
+  // fill the heap-side fields of a mesh_introspect_t snapshot; must
+  // be called with lock() held (the caller also aggregates the
+  // per-thread counters under the same lock)
+  void introspectLocked(mesh_introspect_t *stats) const {
+    static_assert(MESH_MAX_SIZE_CLASSES == kNumBins, "introspect struct out of sync with kNumBins");
+    static_assert(MESH_OCCUPANCY_BANDS == kOccupancyBands, "introspect struct out of sync with kOccupancyBands");
+
+    stats->size_class_count = kNumBins;
+    stats->mesh_count = _stats.meshCount;
+    stats->meshed_page_count = Super::meshedPageCount();
+    stats->meshed_page_hwm = Super::meshedPageHighWaterMark();
+    stats->dirty_page_count = Super::dirtyPageCount();
+    stats->miniheap_count = _miniheapCount;
+    stats->miniheap_alloc_count = _stats.mhAllocCount;
+    stats->miniheap_free_count = _stats.mhFreeCount;
+
+    for (size_t i = 0; i < kNumBins; i++) {
+      mesh_size_class_stats_t &sc = stats->size_classes[i];
+      sc.object_size = SizeMap::ByteSizeForClass(i);
+      sc.empty = _emptyFreelist[i].second;
+      for (size_t band = 0; band < kOccupancyBands; band++) {
+        sc.partial[band] = _partialFreelist[i][band].second;
+      }
+      sc.full = _fullList[i].second;
+      sc.meshed_pages = _stats.classMeshedPages[i];
+    }
+  }
+
+  // must be called with the size class's lock shard held (or, for
+  // large allocations, with no shard at all); takes the arena lock
+  // itself.
   inline MiniHeap *ATTRIBUTE_ALWAYS_INLINE allocMiniheapLocked(int sizeClass, size_t pageCount, size_t objectCount,
-                                                               size_t objectSize, size_t pageAlignment = 1) {
+                                                               size_t objectSize, size_t pageAlignment = 1,
+                                                               bool *zeroed = nullptr, void *metadataBuf = nullptr) {
     d_assert(0 < pageCount);
 
-    void *buf = _mhAllocator.alloc();
+    lock_guard<mutex> lock(_arenaLock);
+
+    void *buf = metadataBuf != nullptr ? metadataBuf : _mhAllocator.alloc();
     d_assert(buf != nullptr);
 
-    // allocate out of the arena
+    // allocate out of the arena.  Only single-object (large)
+    // miniheaps can never mesh now that page-multiple classes are
+    // meshable, so only they go to the THP-backed tier, where
+    // beginMesh will never split a huge page.
+    const bool hugeEligible = objectCount == 1;
     Span span{0, 0};
-    char *spanBegin = Super::pageAlloc(span, pageCount, pageAlignment);
+    char *spanBegin = Super::pageAlloc(span, pageCount, pageAlignment, hugeEligible, zeroed);
     d_assert(spanBegin != nullptr);
     d_assert((reinterpret_cast<uintptr_t>(spanBegin) / kPageSize) % pageAlignment == 0);
 
@@ -132,7 +547,7 @@ public:
     return mh;
   }
 
-  inline void *pageAlignedAlloc(size_t pageAlignment, size_t pageCount) {
+  inline void *pageAlignedAlloc(size_t pageAlignment, size_t pageCount, bool *zeroed = nullptr) {
     // if given a very large allocation size (e.g. (uint64_t)-8), it is possible
     // the pageCount calculation overflowed.  An allocation that big is impossible
     // to satisfy anyway, so just fail early.
@@ -140,9 +555,21 @@ public:
       return nullptr;
     }
 
-    lock_guard<mutex> lock(_miniheapLock);
+    // common case: reuse a recently freed span of exactly this size
+    // without touching the arena at all
+    if (likely(pageAlignment == 1) && pageCount <= kMaxFastLargeSize / kPageSize) {
+      MiniHeap *cached = popLargeSpan(pageCount);
+      if (cached != nullptr) {
+        if (zeroed != nullptr) {
+          *zeroed = false;
+        }
+        return reinterpret_cast<void *>(cached->getSpanStart(arenaBegin()));
+      }
+    }
 
-    MiniHeap *mh = allocMiniheapLocked(-1, pageCount, 1, pageCount * kPageSize, pageAlignment);
+    // large allocations never live on a size-class freelist, so the
+    // arena lock (taken inside allocMiniheapLocked) is all we need.
+    MiniHeap *mh = allocMiniheapLocked(-1, pageCount, 1, pageCount * kPageSize, pageAlignment, zeroed);
 
     d_assert(mh->isLargeAlloc());
     d_assert(mh->spanSize() == pageCount * kPageSize);
@@ -153,12 +580,12 @@ public:
     return ptr;
   }
 
-  inline MiniHeapListEntry *freelistFor(uint8_t freelistId, int sizeClass) {
+  inline MiniHeapListEntry *freelistFor(uint8_t freelistId, uint32_t band, int sizeClass) {
     switch (freelistId) {
     case list::Empty:
       return &_emptyFreelist[sizeClass].first;
     case list::Partial:
-      return &_partialFreelist[sizeClass].first;
+      return &_partialFreelist[sizeClass][band].first;
     case list::Full:
       return &_fullList[sizeClass].first;
     }
@@ -166,6 +593,22 @@ public:
     return nullptr;
   }
 
+  inline MiniHeapListEntry *freelistFor(MiniHeap *mh) {
+    return freelistFor(mh->freelistId(), mh->occupancyBand(), mh->sizeClass());
+  }
+
+  inline std::pair<MiniHeapListEntry, size_t> *freelistPairFor(uint8_t freelistId, uint32_t band, int sizeClass) {
+    switch (freelistId) {
+    case list::Empty:
+      return &_emptyFreelist[sizeClass];
+    case list::Partial:
+      return &_partialFreelist[sizeClass][band];
+    case list::Full:
+      return &_fullList[sizeClass];
+    }
+    return nullptr;
+  }
+
   inline bool postFreeLocked(MiniHeap *mh, int sizeClass, size_t inUse) {
     // its possible we raced between reading isAttached + grabbing a lock.
     // just check here to avoid having to play whack-a-mole at each call site.
@@ -173,11 +616,13 @@ public:
       return false;
     }
     const auto currFreelistId = mh->freelistId();
-    auto currFreelist = freelistFor(currFreelistId, sizeClass);
+    const auto currBand = mh->occupancyBand();
+    auto currFreelist = freelistFor(currFreelistId, currBand, sizeClass);
     const auto max = mh->maxCount();
 
     std::pair<MiniHeapListEntry, size_t> *list;
     uint8_t newListId;
+    uint32_t newBand = 0;
 
     if (inUse == 0) {
       // if the miniheap is already in the right list there is nothing to do
@@ -193,19 +638,51 @@ public:
       newListId = list::Full;
       list = &_fullList[sizeClass];
     } else {
-      if (currFreelistId == list::Partial) {
+      newBand = occupancyBandFor(inUse, max);
+      // already on the right band's list: nothing to do
+      if (currFreelistId == list::Partial && currBand == newBand) {
         return false;
       }
       newListId = list::Partial;
-      list = &_partialFreelist[sizeClass];
+      list = &_partialFreelist[sizeClass][newBand];
+    }
+
+    // keep the count of the list we're leaving honest, so the
+    // empty-bin flush trigger doesn't drift
+    auto currList = freelistPairFor(currFreelistId, currBand, sizeClass);
+    if (currList != nullptr && currList->second > 0) {
+      currList->second--;
     }
 
+    mh->setOccupancyBand(newBand);
     list->first.add(currFreelist, newListId, list::Head, mh);
     list->second++;
 
     return _emptyFreelist[sizeClass].second > kBinnedTrackerMaxEmpty;
   }
 
+  // apply freelist transitions that remote frees deferred into the
+  // size class's stash.  Must be called with the class's shard held.
+  inline void drainPendingFreesLocked(size_t sizeClass) {
+    bool shouldFlush = false;
+
+    MiniHeapID id = _pendingFrees[sizeClass].pop();
+    while (id.hasValue()) {
+      MiniHeap *mh = GetMiniHeap(id);
+      // the miniheap's slot may have been recycled since the push (it
+      // can be freed by a competing locked free or a mesh); only act
+      // on it if it still clearly belongs to this size class.
+      if (static_cast<size_t>(mh->sizeClass()) == sizeClass && !mh->isMeshed() && !mh->isLargeAlloc()) {
+        shouldFlush |= postFreeLocked(mh, sizeClass, mh->inUseCount());
+      }
+      id = _pendingFrees[sizeClass].pop();
+    }
+
+    if (unlikely(shouldFlush)) {
+      flushBinLocked(sizeClass);
+    }
+  }
+
   inline void releaseMiniheapLocked(MiniHeap *mh, int sizeClass) {
     // ensure this flag is always set with the miniheap lock held
     mh->unsetAttached();
@@ -219,22 +696,25 @@ public:
       return;
     }
 
-    lock_guard<mutex> lock(_miniheapLock);
+    // all miniheaps in a shuffle vector share a single size class
+    const int sizeClass = miniheaps[0]->sizeClass();
+    lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
     for (auto mh : miniheaps) {
-      releaseMiniheapLocked(mh, mh->sizeClass());
+      d_assert(mh->sizeClass() == sizeClass);
+      releaseMiniheapLocked(mh, sizeClass);
     }
     miniheaps.clear();
   }
 
   template <uint32_t Size>
   size_t fillFromList(FixedArray<MiniHeap, Size> &miniheaps, pid_t current,
-                      std::pair<MiniHeapListEntry, size_t> &freelist, size_t bytesFree) {
+                      std::pair<MiniHeapListEntry, size_t> &freelist, size_t bytesFree, size_t maxMiniheaps) {
     if (freelist.first.empty()) {
       return bytesFree;
     }
 
     auto nextId = freelist.first.next();
-    while (nextId != list::Head && bytesFree < kMiniheapRefillGoalSize && !miniheaps.full()) {
+    while (nextId != list::Head && bytesFree < kMiniheapRefillGoalSize && miniheaps.size() < maxMiniheaps) {
       auto mh = GetMiniHeap(nextId);
       d_assert(mh != nullptr);
       nextId = mh->getFreelist()->next();
@@ -247,7 +727,7 @@ public:
       // thread-local cache, things perform better!
       // bytesFree += mh->bytesFree();
       d_assert(!mh->isAttached());
-      mh->setAttached(current, freelistFor(mh->freelistId(), mh->sizeClass()));
+      mh->setAttached(current, freelistFor(mh));
       d_assert(mh->isAttached() && mh->current() == current);
       hard_assert(!miniheaps.full());
       miniheaps.append(mh);
@@ -259,25 +739,42 @@ public:
   }
 
   template <uint32_t Size>
-  size_t selectForReuse(int sizeClass, FixedArray<MiniHeap, Size> &miniheaps, pid_t current) {
-    size_t bytesFree = fillFromList(miniheaps, current, _partialFreelist[sizeClass], 0);
-
-    if (bytesFree >= kMiniheapRefillGoalSize || miniheaps.full()) {
-      return bytesFree;
+  size_t selectForReuse(int sizeClass, FixedArray<MiniHeap, Size> &miniheaps, pid_t current, size_t maxMiniheaps) {
+    size_t bytesFree = 0;
+
+    // prefer the fullest partial miniheaps: they soak up allocations
+    // with the least metadata churn, and leaving sparse miniheaps
+    // unattached keeps them available as mesh candidates.
+    for (size_t band = kOccupancyBands; band > 0; band--) {
+      bytesFree = fillFromList(miniheaps, current, _partialFreelist[sizeClass][band - 1], bytesFree, maxMiniheaps);
+      if (bytesFree >= kMiniheapRefillGoalSize || miniheaps.size() >= maxMiniheaps) {
+        return bytesFree;
+      }
     }
 
     // we've exhausted all of our partially full MiniHeaps, but there
     // might still be empty ones we could reuse.
-    return fillFromList(miniheaps, current, _emptyFreelist[sizeClass], bytesFree);
+    return fillFromList(miniheaps, current, _emptyFreelist[sizeClass], bytesFree, maxMiniheaps);
   }
 
   template <uint32_t Size>
   inline void allocSmallMiniheaps(int sizeClass, uint32_t objectSize, FixedArray<MiniHeap, Size> &miniheaps,
-                                  pid_t current) {
-    lock_guard<mutex> lock(_miniheapLock);
+                                  pid_t current, size_t maxMiniheaps = Size) {
+    if (maxMiniheaps < 2) {
+      maxMiniheaps = 2;
+    }
+    if (maxMiniheaps > Size) {
+      maxMiniheaps = Size;
+    }
+
+    lock_guard<mutex> lock(_miniheapLocks[sizeClass]);
 
     d_assert(sizeClass >= 0);
 
+    // we hold the shard anyway; pick up any transitions remote frees
+    // have deferred so the freelists we select from are current
+    drainPendingFreesLocked(sizeClass);
+
     for (MiniHeap *oldMH : miniheaps) {
       releaseMiniheapLocked(oldMH, sizeClass);
     }
@@ -297,32 +794,117 @@ public:
     d_assert(miniheaps.size() == 0);
 
     // check our bins for a miniheap to reuse
-    auto bytesFree = selectForReuse(sizeClass, miniheaps, current);
-    if (bytesFree >= kMiniheapRefillGoalSize || miniheaps.full()) {
+    auto bytesFree = selectForReuse(sizeClass, miniheaps, current, maxMiniheaps);
+    if (bytesFree >= kMiniheapRefillGoalSize || miniheaps.size() >= maxMiniheaps) {
       return;
     }
 
     // if we have objects bigger than the size of a page, allocate
     // multiple pages to amortize the cost of creating a
     // miniheap/globally locking the heap.  For example, asking for
-    // 2048 byte objects would allocate 4 4KB pages.
-    const size_t objectCount = max(kPageSize / objectSize, kMinStringLen);
+    // 2048 byte objects would allocate 4 4KB pages.  Page-multiple
+    // classes get a smaller object count (and a single miniheap per
+    // refill below) so one refill can't commit tens of megabytes.
+    const size_t objectCount =
+        objectSize >= kPageSize ? 4 : max(kPageSize / objectSize, kMinStringLen);
     const size_t pageCount = PageCount(objectSize * objectCount);
 
-    while (bytesFree < kMiniheapRefillGoalSize && !miniheaps.full()) {
-      auto mh = allocMiniheapLocked(sizeClass, pageCount, objectCount, objectSize);
+    // for sub-page classes this loop runs until the fixed array is
+    // full, so we know the miniheap count up front: carve all their
+    // metadata slots contiguously in one pass so a refill storm's
+    // miniheaps share cachelines instead of scattering across the slab
+    void *metadataBufs[Size];
+    size_t batched = 0;
+    size_t used = 0;
+    if (objectSize < kPageSize) {
+      batched = maxMiniheaps - miniheaps.size();
+      lock_guard<mutex> arenaLock(_arenaLock);
+      _mhAllocator.allocBatch(metadataBufs, batched);
+    }
+
+    while (bytesFree < kMiniheapRefillGoalSize && miniheaps.size() < maxMiniheaps) {
+      void *buf = used < batched ? metadataBufs[used++] : nullptr;
+      auto mh = allocMiniheapLocked(sizeClass, pageCount, objectCount, objectSize, 1, nullptr, buf);
       d_assert(!mh->isAttached());
-      mh->setAttached(current, freelistFor(mh->freelistId(), sizeClass));
+      mh->setAttached(current, freelistFor(mh));
       d_assert(mh->isAttached() && mh->current() == current);
       miniheaps.append(mh);
       bytesFree += mh->bytesFree();
+      if (objectSize >= kPageSize) {
+        break;
+      }
+    }
+
+    // shouldn't happen (the loop consumes the whole batch), but never
+    // strand carved slots
+    if (unlikely(used < batched)) {
+      lock_guard<mutex> arenaLock(_arenaLock);
+      while (used < batched) {
+        _mhAllocator.free(metadataBufs[used++]);
+      }
     }
 
     return;
   }
 
-  // large, page-multiple allocations
-  void *ATTRIBUTE_NEVER_INLINE malloc(size_t sz);
+  // large, page-multiple allocations.  When zeroed is non-null it is
+  // set iff the returned memory is already zero (so calloc can skip
+  // its memset).
+  void *ATTRIBUTE_NEVER_INLINE malloc(size_t sz, bool *zeroed = nullptr);
+
+  // try to resize ptr's allocation in place.  Small objects succeed
+  // iff the new size still fits their size class; large (page-backed)
+  // allocations can grow by claiming physically adjacent free pages
+  // from the arena.
+  bool tryReallocInPlace(void *ptr, size_t newSize) {
+    if (unlikely(ptr == nullptr)) {
+      return false;
+    }
+
+    auto mh = miniheapFor(ptr);
+    if (unlikely(mh == nullptr)) {
+      return false;
+    }
+
+    if (!mh->isLargeAlloc()) {
+      // the caller owns a live object, so the miniheap can't be freed
+      // from under us; in-class growth needs no metadata updates
+      return newSize <= mh->objectSize();
+    }
+
+    lock_guard<mutex> lock(_arenaLock);
+
+    // revalidate under the lock that guards large miniheap lifetime
+    mh = miniheapFor(ptr);
+    if (unlikely(mh == nullptr || !mh->isLargeAlloc())) {
+      return false;
+    }
+    if (unlikely(mh->getSpanStart(arenaBegin()) != reinterpret_cast<uintptr_t>(ptr))) {
+      return false;
+    }
+
+    const size_t oldPageCount = mh->span().length;
+    const size_t newPageCount = PageCount(newSize);
+    if (newPageCount <= oldPageCount) {
+      // shrinks are already in place
+      return true;
+    }
+
+    const auto extraPages = static_cast<Length>(newPageCount - oldPageCount);
+    if (!Super::tryExtendSpan(mh->span(), extraPages)) {
+      return false;
+    }
+
+    const Span extension{static_cast<Offset>(mh->span().offset + oldPageCount), extraPages};
+    Super::trackMiniHeap(extension, miniheapIDFor(mh));
+    mh->extendSpan(extraPages);
+
+    return true;
+  }
+
+  inline size_t ATTRIBUTE_ALWAYS_INLINE meshEpoch() const {
+    return _meshEpoch.current();
+  }
 
   inline MiniHeap *ATTRIBUTE_ALWAYS_INLINE miniheapForWithEpoch(const void *ptr, size_t &currentEpoch) const {
     currentEpoch = _meshEpoch.current();
@@ -347,11 +929,20 @@ public:
   void untrackMiniheapLocked(MiniHeap *mh) {
     // mesh::debug("%p (%u) untracked!\n", mh, GetMiniHeapID(mh));
     _stats.mhAllocCount -= 1;
-    mh->getFreelist()->remove(freelistFor(mh->freelistId(), mh->sizeClass()));
+    mh->getFreelist()->remove(freelistFor(mh));
   }
 
   void freeFor(MiniHeap *mh, void *ptr, size_t startEpoch);
 
+  // free a batch of pointers (from a thread-local free buffer) in one
+  // pass, deferring the meshing decision to the end of the batch
+  void freeBatch(void *const *ptrs, size_t count);
+
+  // sorted bulk free (mesh_free_batch): group pointers by miniheap,
+  // clear each miniheap's bits with one word-wise pass, and perform
+  // one freelist classification per distinct miniheap
+  void freeBatchSorted(void *const *ptrs, size_t count);
+
   // called with lock held
   void freeMiniheapAfterMeshLocked(MiniHeap *mh, bool untrack = true) {
     // don't untrack a meshed miniheap -- it has already been untracked
@@ -368,10 +959,12 @@ public:
   }
 
   void freeMiniheap(MiniHeap *&mh, bool untrack = true) {
-    lock_guard<mutex> lock(_miniheapLock);
+    lock_guard<mutex> lock(_miniheapLocks[mh->sizeClass()]);
     freeMiniheapLocked(mh, untrack);
   }
 
+  // called with the relevant size-class shard held (for small
+  // miniheaps); takes the arena lock itself.
   void freeMiniheapLocked(MiniHeap *&mh, bool untrack) {
     const auto spanSize = mh->spanSize();
     MiniHeap *toFree[kMaxMeshes];
@@ -385,6 +978,8 @@ public:
       return false;
     });
 
+    lock_guard<mutex> lock(_arenaLock);
+
     for (size_t i = 0; i < last; i++) {
       MiniHeap *mh = toFree[i];
       const bool isMeshed = mh->isMeshed();
@@ -424,19 +1019,38 @@ public:
     if (unlikely(ptr == nullptr))
       return 0;
 
-    lock_guard<mutex> lock(_miniheapLock);
-    auto mh = miniheapFor(ptr);
-    if (likely(mh)) {
-      return mh->objectSize();
-    } else {
-      return 0;
+    // optimistic and lock-free: a live pointer pins its miniheap (an
+    // object in use is never flushed, and large miniheaps live until
+    // their one object is freed), and relocation by meshing preserves
+    // the size class -- so the answer is stable even across a
+    // concurrent mesh.  The epoch check just avoids reading metadata
+    // mid-consume; under persistent meshing churn the last read is
+    // still correct for exactly that reason.  Reads of a recycled
+    // slot can't fault (the metadata slab is never unmapped); they
+    // can only happen for pointers that were already freed, where any
+    // answer is acceptable.
+    size_t size = 0;
+    for (int attempt = 0; attempt < 4; attempt++) {
+      const size_t startEpoch = _meshEpoch.current();
+
+      auto mh = miniheapFor(ptr);
+      if (unlikely(mh == nullptr)) {
+        return 0;
+      }
+      size = mh->objectSize();
+
+      if (likely(startEpoch % 2 == 0 && _meshEpoch.isSame(startEpoch))) {
+        break;
+      }
     }
+
+    return size;
   }
 
   int mallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
 
   size_t getAllocatedMiniheapCount() const {
-    lock_guard<mutex> lock(_miniheapLock);
+    lock_guard<mutex> lock(_arenaLock);
     return _miniheapCount;
   }
 
@@ -444,14 +1058,51 @@ public:
     _meshPeriodMs = period;
   }
 
+  // a non-zero budget enables incremental meshing: each mesh cycle
+  // processes size classes only until the budget expires, and the
+  // next cycle picks up where it left off.
+  void setMeshPauseBudgetUs(std::chrono::microseconds budget) {
+    _meshPauseBudget = budget;
+  }
+
+  // with adaptive set, the mesh period floats between min and max
+  // depending on whether fragmentation (mesh yield + RSS trend) is
+  // growing; otherwise mesh cycles run at a fixed min period.
+  void setMeshPolicy(std::chrono::milliseconds minPeriod, std::chrono::milliseconds maxPeriod, bool adaptive) {
+    if (minPeriod > maxPeriod) {
+      maxPeriod = minPeriod;
+    }
+    _meshPeriodMinMs = minPeriod;
+    _meshPeriodMaxMs = maxPeriod;
+    _adaptiveMeshPeriod = adaptive;
+    _meshPeriodMs = minPeriod;
+  }
+
+  // the shards are always acquired in ascending size-class order,
+  // followed by the arena lock; anything that takes a shard and then
+  // needs the arena must follow the same order.
+  void lockAllShards() const {
+    for (size_t i = 0; i < kNumBins; i++) {
+      _miniheapLocks[i].lock();
+    }
+  }
+
+  void unlockAllShards() const {
+    for (size_t i = kNumBins; i > 0; i--) {
+      _miniheapLocks[i - 1].unlock();
+    }
+  }
+
   void lock() {
-    _miniheapLock.lock();
+    lockAllShards();
+    _arenaLock.lock();
     // internal::Heap().lock();
   }
 
   void unlock() {
     // internal::Heap().unlock();
-    _miniheapLock.unlock();
+    _arenaLock.unlock();
+    unlockAllShards();
   }
 
   // PUBLIC ONLY FOR TESTING
@@ -478,7 +1129,7 @@ public:
       return;
     }
 
-    lock_guard<mutex> lock(_miniheapLock);
+    lockAllShards();
 
     {
       // ensure if two threads tried to grab the mesh lock at the same
@@ -488,50 +1139,85 @@ public:
       auto duration = chrono::duration_cast<chrono::milliseconds>(lockedNow - _lastMesh);
 
       if (unlikely(duration < _meshPeriodMs)) {
+        unlockAllShards();
         return;
       }
     }
 
     _lastMesh = now;
 
-    meshAllSizeClassesLocked();
+    if (_meshPauseBudget == kZeroUs) {
+      meshAllSizeClassesLocked();
+    } else {
+      meshSizeClassesIncrementalLocked();
+    }
+
+    unlockAllShards();
   }
 
   inline bool okToProceed(void *ptr) const {
-    lock_guard<mutex> lock(_miniheapLock);
-
     if (ptr == nullptr) {
       return false;
     }
 
-    return miniheapFor(ptr) != nullptr;
+    // meshing holds every shard, so acquiring them all is still a
+    // barrier that ensures any in-progress mesh has completed.
+    lockAllShards();
+    const bool ok = miniheapFor(ptr) != nullptr;
+    unlockAllShards();
+
+    return ok;
   }
 
   inline internal::vector<MiniHeap *> meshingCandidatesLocked(int sizeClass) const {
     // FIXME: duplicated with code in halfSplit
     internal::vector<MiniHeap *> bucket{};
 
-    auto nextId = _partialFreelist[sizeClass].first.next();
-    while (nextId != list::Head) {
-      auto mh = GetMiniHeap(nextId);
-      if (mh->isMeshingCandidate() && (mh->fullness() < kOccupancyCutoff)) {
-        bucket.push_back(mh);
+    // the top occupancy band is at/above the cutoff and never meshes
+    for (size_t band = 0; band < kOccupancyBands - 1; band++) {
+      auto nextId = _partialFreelist[sizeClass][band].first.next();
+      while (nextId != list::Head) {
+        auto mh = GetMiniHeap(nextId);
+        if (mh->isMeshingCandidate() && (mh->fullness() < kOccupancyCutoff)) {
+          bucket.push_back(mh);
+        }
+        nextId = mh->getFreelist()->next();
       }
-      nextId = mh->getFreelist()->next();
     }
 
     return bucket;
   }
 
 private:
+  // freeFor minus the maybeMesh call; returns whether the caller
+  // should consider meshing
+  bool freeForInner(MiniHeap *mh, void *ptr, size_t startEpoch);
+
   // check for meshes in all size classes -- must be called LOCKED
   void meshAllSizeClassesLocked();
-  // meshSizeClassLocked returns the number of merged sets found
-  size_t meshSizeClassLocked(size_t sizeClass, MergeSetArray &mergeSets, SplitArray &left, SplitArray &right);
+  // like meshAllSizeClassesLocked, but stops once _meshPauseBudget
+  // has been spent, resuming from _meshCursor on the next call
+  void meshSizeClassesIncrementalLocked();
+  // meshSizeClassLocked returns the number of merged sets found;
+  // merging stops early once `deadline` has passed
+  size_t meshSizeClassLocked(size_t sizeClass, MergeSetArray &mergeSets, SplitArray &left, SplitArray &right,
+                             time::time_point deadline = time::time_point::max());
+  // adjust the mesh period after a completed cycle/sweep found
+  // `meshCount` merges; no-op unless the adaptive policy is enabled
+  void adaptMeshPeriodLocked(size_t meshCount);
 
   const size_t _maxObjectSize;
   atomic_size_t _meshPeriod{kDefaultMeshPeriod};
   std::chrono::milliseconds _meshPeriodMs{kMeshPeriodMs};
+  std::chrono::milliseconds _meshPeriodMinMs{kMeshPeriodMinMs};
+  std::chrono::milliseconds _meshPeriodMaxMs{kMeshPeriodMaxMs};
+  bool _adaptiveMeshPeriod{false};
+  size_t _lastCycleRssKb{0};
+  std::chrono::microseconds _meshPauseBudget{kZeroUs};
+
+  // next size class the incremental mesher will look at; only
+  // meaningful between incremental mesh slices (all shards held)
+  size_t _meshCursor{0};
 
   atomic_size_t ATTRIBUTE_ALIGNED(CACHELINE_SIZE) _lastMeshEffective{0};
 
@@ -542,18 +1228,34 @@ private:
   // aligned to avoid sharing cacheline with _meshEpoch
   size_t ATTRIBUTE_ALIGNED(CACHELINE_SIZE) _miniheapCount{0};
 
-  // these must only be accessed or modified with the _miniheapLock held
-  std::array<std::pair<MiniHeapListEntry, size_t>, kNumBins> _emptyFreelist{
-      Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head,
-      Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head};
-  std::array<std::pair<MiniHeapListEntry, size_t>, kNumBins> _partialFreelist{
-      Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head,
-      Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head};
-  std::array<std::pair<MiniHeapListEntry, size_t>, kNumBins> _fullList{
-      Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head,
-      Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head, Head};
+  // these must only be accessed or modified with the corresponding
+  // size class's lock shard held
+  std::array<std::pair<MiniHeapListEntry, size_t>, kNumBins> _emptyFreelist{};
+  // partially-full miniheaps, bucketed by occupancy band (see
+  // occupancyBandFor); initialized in the constructor
+  std::array<std::array<std::pair<MiniHeapListEntry, size_t>, kOccupancyBands>, kNumBins> _partialFreelist{};
+  std::array<std::pair<MiniHeapListEntry, size_t>, kNumBins> _fullList{};
+
+  // the miniheap lock is sharded by size class so that refills and
+  // frees of different size classes never contend; the arena lock
+  // protects the page-level state we inherit from MeshableArena (and
+  // _miniheapCount/_stats, which are updated on the same paths).
+  mutable std::array<mutex, kNumBins> _miniheapLocks{};
+  mutable mutex _arenaLock{};
+
+  // meshing runs under every shard, while the arena's _fastPrng is
+  // used under the arena lock alone -- give the mesh scan its own
+  // generator so the two never race.
+  MWC _meshPrng{internal::seed(), internal::seed()};
+
+  // remote frees park deferred freelist transitions here, one stash
+  // per size class, instead of contending on the lock shards
+  std::array<PendingFreeStash, kNumBins> _pendingFrees{};
+
+  std::array<ClassMeshPolicy, kNumBins> _classMeshPolicy{};
 
-  mutable mutex _miniheapLock{};
+  // recently freed large spans, bucketed by page count
+  LargeSpanBucket _largeSpanCache[kLargeSpanBuckets]{};
 
   GlobalHeapStats _stats{};
 
@@ -561,7 +1263,6 @@ private:
   time::time_point _lastMesh;
 };
 
-static_assert(kNumBins == 25, "if this changes, add more 'Head's above");
 static_assert(sizeof(std::array<MiniHeapListEntry, kNumBins>) == kNumBins * 8, "list size is right");
 static_assert(sizeof(GlobalHeap) < (kNumBins * 8 * 3 + 64 * 7 + 100000), "gh small enough");
 }  // namespace mesh
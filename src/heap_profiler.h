@@ -0,0 +1,93 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright 2019 The Mesh Authors. All rights reserved.
+// Use of this source code is governed by the Apache License,
+// Version 2.0, that can be found in the LICENSE file.
+
+#pragma once
+#ifndef MESH_HEAP_PROFILER_H
+#define MESH_HEAP_PROFILER_H
+
+#include <limits>
+
+#include "internal.h"
+
+namespace mesh {
+
+static constexpr size_t kProfileMaxStackDepth = 16;
+static constexpr size_t kProfileThreadBufferLen = 64;
+static constexpr size_t kProfileMaxSamples = 8192;
+
+struct ProfileSample {
+  uint64_t bytes;
+  uint32_t depth;
+  void *stack[kProfileMaxStackDepth];
+};
+
+// walk the frame-pointer chain; needs -fno-omit-frame-pointer for
+// full stacks, degrades to shallow ones without it.  skipFrames drops
+// the profiler's own frames.
+static inline size_t ATTRIBUTE_ALWAYS_INLINE captureStack(void **stack, size_t maxDepth, size_t skipFrames) {
+  void **fp = reinterpret_cast<void **>(__builtin_frame_address(0));
+  size_t depth = 0;
+
+  while (depth < maxDepth && fp != nullptr) {
+    void *ret = fp[1];
+    if (ret == nullptr) {
+      break;
+    }
+    if (skipFrames > 0) {
+      skipFrames--;
+    } else {
+      stack[depth++] = ret;
+    }
+
+    void **next = reinterpret_cast<void **>(fp[0]);
+    // frames must strictly ascend and stay within a sane distance,
+    // or we're off in the weeds (e.g. a frame built without -fno-omit-frame-pointer)
+    if (next <= fp || reinterpret_cast<uintptr_t>(next) - reinterpret_cast<uintptr_t>(fp) > (1 << 20)) {
+      break;
+    }
+    fp = next;
+  }
+
+  return depth;
+}
+
+// a tcmalloc-style sampling profiler: every _sampleInterval allocated
+// bytes (statistically, per thread) the allocation path records a
+// stack into its thread's buffer; full buffers are flushed into the
+// global table here, and mesh_dump_heap_profile() exports it in the
+// legacy pprof heap format.  Statics live in thread_local_heap.cc.
+class HeapProfiler {
+public:
+  static inline bool ATTRIBUTE_ALWAYS_INLINE enabled() {
+    return _sampleInterval > 0;
+  }
+
+  static inline ssize_t sampleInterval() {
+    return _sampleInterval;
+  }
+
+  // the value threads load into their countdown when sampling is off;
+  // large enough that the decrement-and-branch never fires
+  static constexpr ssize_t kDisabledCountdown = std::numeric_limits<ssize_t>::max();
+
+  static void enable(ssize_t everyBytes);
+
+  // append a thread's buffered samples to the global table (brief
+  // spinlock; the per-thread buffers themselves are lock-free)
+  static void flush(const ProfileSample *samples, size_t count);
+
+  // write the aggregated profile to path; returns 0 on success
+  static int dumpProfile(const char *path);
+
+private:
+  static ssize_t _sampleInterval;
+  static atomic<uint32_t> _tableLock;
+  static ProfileSample *_samples;  // lazily allocated, kProfileMaxSamples entries
+  static size_t _sampleCount;
+};
+
+}  // namespace mesh
+
+#endif  // MESH_HEAP_PROFILER_H
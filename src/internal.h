@@ -8,11 +8,14 @@
 #define MESH_INTERNAL_H
 
 #ifdef __linux__
+#include <sched.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 #endif
 
 #include <atomic>
+#include <map>
+#include <set>
 #include <unordered_set>
 
 #include <signal.h>
@@ -279,15 +282,87 @@ inline void *MaskToPage(const void *ptr) {
 // efficiently copy data from srcFd to dstFd
 int copyFile(int dstFd, int srcFd, off_t off, size_t sz);
 
-// for mesh-internal data structures, like heap metadata
-class Heap : public ExactlyOneHeap<LockedHeap<PosixLockType, PartitionedHeap>> {
+// the allocator for mesh-internal data structures (heap metadata,
+// span vectors, internal strings).  The small path is sharded by CPU
+// so metadata growth during mesh cycles and scavenges doesn't contend
+// with itself; shard routing on free is lock-free, by fixed
+// small-arena bounds.  Big internal allocations share one locked mmap
+// heap so their ownership is unambiguous.
+static constexpr size_t kInternalHeapShards = 4;
+
+class Heap {
 private:
-  typedef ExactlyOneHeap<LockedHeap<PosixLockType, PartitionedHeap>> SuperHeap;
+  typedef LockedHeap<PosixLockType, PartitionedHeap> ShardHeap;
+  typedef LockedHeap<PosixLockType, HL::MmapHeap> BigHeap;
+
+  static inline ShardHeap &shard(size_t i) {
+    static ShardHeap shards[kInternalHeapShards];
+    return shards[i];
+  }
+
+  static inline BigHeap &bigHeap() {
+    static BigHeap big;
+    return big;
+  }
+
+  static inline size_t pickShard() {
+#ifdef __linux__
+    const int cpu = sched_getcpu();
+    if (likely(cpu >= 0)) {
+      return static_cast<size_t>(cpu) % kInternalHeapShards;
+    }
+#endif
+    return 0;
+  }
 
 public:
-  Heap() : SuperHeap() {
+  enum { Alignment = 16 };
+
+  Heap() {
     static_assert(Alignment % 16 == 0, "16-byte alignment");
   }
+
+  inline void *malloc(size_t sz) {
+    // route sizes past the partitioned bins to the shared big heap
+    // directly, so a free can identify the owner by bounds alone
+    if (unlikely(powerOfTwo::ClassForByteSize(sz) >= kPartitionedHeapNBins)) {
+      return bigHeap().malloc(sz);
+    }
+    return shard(pickShard()).malloc(sz);
+  }
+
+  inline void free(void *ptr) {
+    if (unlikely(ptr == nullptr)) {
+      return;
+    }
+
+    // small-arena bounds are fixed at construction; no lock needed to
+    // route
+    for (size_t i = 0; i < kInternalHeapShards; i++) {
+      if (shard(i).contains(ptr)) {
+        shard(i).free(ptr);
+        return;
+      }
+    }
+
+    bigHeap().free(ptr);
+  }
+
+  // lock/unlock every shard (and the big heap), in order; used around
+  // fork
+  inline void lock() {
+    for (size_t i = 0; i < kInternalHeapShards; i++) {
+      shard(i).lock();
+    }
+    bigHeap().lock();
+  }
+
+  inline void unlock() {
+    bigHeap().unlock();
+    for (size_t i = kInternalHeapShards; i > 0; i--) {
+      shard(i - 1).unlock();
+    }
+  }
 };
 
 // make a shared pointer allocated from our internal heap that will
@@ -308,6 +383,9 @@ using unordered_map = std::unordered_map<K, V, hash<K>, equal_to<K>, STLAllocato
 template <typename K>
 using unordered_set = std::unordered_set<K, hash<K>, equal_to<K>, STLAllocator<K, Heap>>;
 
+template <typename K>
+using set = std::set<K, less<K>, STLAllocator<K, Heap>>;
+
 template <typename K, typename V>
 using map = std::map<K, V, std::less<K>, STLAllocator<pair<const K, V>, Heap>>;
 
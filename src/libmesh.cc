@@ -5,6 +5,7 @@
 
 #include <stdlib.h>
 
+#include "meshing.h"
 #include "runtime.h"
 #include "thread_local_heap.h"
 
@@ -26,6 +27,39 @@ static __attribute__((constructor)) void libmesh_init() {
     runtime().setMeshPeriodMs(std::chrono::milliseconds{period});
   }
 
+  char *pauseBudgetStr = getenv("MESH_PAUSE_BUDGET_US");
+  if (pauseBudgetStr) {
+    long budget = strtol(pauseBudgetStr, nullptr, 10);
+    if (budget < 0) {
+      budget = 0;
+    }
+    runtime().setMeshPauseBudgetUs(std::chrono::microseconds{budget});
+  }
+
+  char *sampleBytesStr = getenv("MESH_PROFILE_SAMPLE_BYTES");
+  if (sampleBytesStr) {
+    long sampleBytes = strtol(sampleBytesStr, nullptr, 10);
+    if (sampleBytes > 0) {
+      mesh::HeapProfiler::enable(sampleBytes);
+    }
+  }
+
+  char *perCpuStr = getenv("MESH_PERCPU_CACHE");
+  if (perCpuStr && atoi(perCpuStr)) {
+    ThreadLocalHeap::EnablePerCpuMode();
+  }
+
+  char *scanWorkersStr = getenv("MESH_SCAN_WORKERS");
+  if (scanWorkersStr) {
+    long workers = strtol(scanWorkersStr, nullptr, 10);
+    if (workers > 0) {
+      mesh::method::setMeshScanWorkers(static_cast<size_t>(workers));
+    }
+  }
+
+  // finish a warm restart, if the arena mapped a snapshot back in
+  runtime().heap().completeSnapshotRestore();
+
   char *bgThread = getenv("MESH_BACKGROUND_THREAD");
   if (!bgThread)
     return;
@@ -53,18 +87,28 @@ static __attribute__((destructor)) void libmesh_fini() {
 namespace mesh {
 ATTRIBUTE_NEVER_INLINE
 static void *allocSlowpath(size_t sz) {
+  if (unlikely(ThreadLocalHeap::perCpuMode())) {
+    return ThreadLocalHeap::CpuMalloc(sz);
+  }
   ThreadLocalHeap *localHeap = ThreadLocalHeap::GetHeap();
   return localHeap->malloc(sz);
 }
 
 ATTRIBUTE_NEVER_INLINE
 static void *cxxNewSlowpath(size_t sz) {
+  if (unlikely(ThreadLocalHeap::perCpuMode())) {
+    return ThreadLocalHeap::CpuCxxNew(sz);
+  }
   ThreadLocalHeap *localHeap = ThreadLocalHeap::GetHeap();
   return localHeap->cxxNew(sz);
 }
 
 ATTRIBUTE_NEVER_INLINE
 static void freeSlowpath(void *ptr) {
+  if (unlikely(ThreadLocalHeap::perCpuMode())) {
+    ThreadLocalHeap::CpuFree(ptr);
+    return;
+  }
   // instead of instantiating a thread-local heap on free, just free
   // to the global heap directly
   runtime().heap().free(ptr);
@@ -72,24 +116,36 @@ static void freeSlowpath(void *ptr) {
 
 ATTRIBUTE_NEVER_INLINE
 static void *reallocSlowpath(void *oldPtr, size_t newSize) {
+  if (unlikely(ThreadLocalHeap::perCpuMode())) {
+    return ThreadLocalHeap::CpuRealloc(oldPtr, newSize);
+  }
   ThreadLocalHeap *localHeap = ThreadLocalHeap::GetHeap();
   return localHeap->realloc(oldPtr, newSize);
 }
 
 ATTRIBUTE_NEVER_INLINE
 static void *callocSlowpath(size_t count, size_t size) {
+  if (unlikely(ThreadLocalHeap::perCpuMode())) {
+    return ThreadLocalHeap::CpuCalloc(count, size);
+  }
   ThreadLocalHeap *localHeap = ThreadLocalHeap::GetHeap();
   return localHeap->calloc(count, size);
 }
 
 ATTRIBUTE_NEVER_INLINE
 static size_t usableSizeSlowpath(void *ptr) {
+  if (unlikely(ThreadLocalHeap::perCpuMode())) {
+    return ThreadLocalHeap::CpuGetSize(ptr);
+  }
   ThreadLocalHeap *localHeap = ThreadLocalHeap::GetHeap();
   return localHeap->getSize(ptr);
 }
 
 ATTRIBUTE_NEVER_INLINE
 static void *memalignSlowpath(size_t alignment, size_t size) {
+  if (unlikely(ThreadLocalHeap::perCpuMode())) {
+    return ThreadLocalHeap::CpuMemalign(alignment, size);
+  }
   ThreadLocalHeap *localHeap = ThreadLocalHeap::GetHeap();
   return localHeap->memalign(alignment, size);
 }
@@ -119,6 +175,10 @@ extern "C" MESH_EXPORT CACHELINE_ALIGNED_FN void mesh_free(void *ptr) {
 extern "C" MESH_EXPORT CACHELINE_ALIGNED_FN void mesh_sized_free(void *ptr, size_t sz) {
   ThreadLocalHeap *localHeap = ThreadLocalHeap::GetHeapIfPresent();
   if (unlikely(localHeap == nullptr)) {
+    if (unlikely(ThreadLocalHeap::perCpuMode())) {
+      ThreadLocalHeap::CpuSizedFree(ptr, sz);
+      return;
+    }
     mesh::freeSlowpath(ptr);
     return;
   }
@@ -216,6 +276,192 @@ int MESH_EXPORT mesh_mallctl(const char *name, void *oldp, size_t *oldlenp, void
   return mesh::runtime().heap().mallctl(name, oldp, oldlenp, newp, newlen);
 }
 
+// --- embedding API (see plasma/mesh.h) ------------------------------
+
+struct mesh_heap_s {
+  mutex lock{};
+  mesh::internal::unordered_set<void *> live{};
+  unsigned long long allocCount{0};
+  unsigned long long freeCount{0};
+  unsigned long long liveBytes{0};
+};
+
+mesh_heap_t MESH_EXPORT *mesh_create_heap(void) {
+  void *buf = mesh::internal::Heap().malloc(sizeof(mesh_heap_s));
+  if (buf == nullptr) {
+    return nullptr;
+  }
+  return new (buf) mesh_heap_s();
+}
+
+void MESH_EXPORT mesh_destroy_heap(mesh_heap_t *heap) {
+  if (heap == nullptr) {
+    return;
+  }
+
+  for (void *ptr : heap->live) {
+    mesh_free(ptr);
+  }
+
+  heap->~mesh_heap_s();
+  mesh::internal::Heap().free(heap);
+}
+
+void MESH_EXPORT *mesh_heap_alloc(mesh_heap_t *heap, size_t size) {
+  if (heap == nullptr) {
+    return nullptr;
+  }
+
+  void *ptr = mesh_malloc(size);
+  if (ptr == nullptr) {
+    return nullptr;
+  }
+
+  const size_t usable = mesh_malloc_usable_size(ptr);
+
+  lock_guard<mutex> guard(heap->lock);
+  heap->live.insert(ptr);
+  heap->allocCount++;
+  heap->liveBytes += usable;
+
+  return ptr;
+}
+
+void MESH_EXPORT mesh_heap_free(mesh_heap_t *heap, void *ptr) {
+  if (heap == nullptr || ptr == nullptr) {
+    return;
+  }
+
+  {
+    lock_guard<mutex> guard(heap->lock);
+    auto it = heap->live.find(ptr);
+    if (it == heap->live.end()) {
+      // not ours; refuse rather than corrupt another domain
+      return;
+    }
+    heap->live.erase(it);
+    heap->freeCount++;
+    const size_t usable = mesh_malloc_usable_size(ptr);
+    heap->liveBytes = heap->liveBytes >= usable ? heap->liveBytes - usable : 0;
+  }
+
+  mesh_free(ptr);
+}
+
+int MESH_EXPORT mesh_heap_stats(mesh_heap_t *heap, mesh_heap_stats_t *stats) {
+  if (heap == nullptr || stats == nullptr) {
+    return -1;
+  }
+
+  lock_guard<mutex> guard(heap->lock);
+  stats->alloc_count = heap->allocCount;
+  stats->free_count = heap->freeCount;
+  stats->live_bytes = heap->liveBytes;
+  stats->live_count = heap->live.size();
+  return 0;
+}
+
+// Direct meshing effort per size class; see plasma/mesh.h.
+int MESH_EXPORT mesh_set_class_policy(unsigned int size_class, const mesh_class_policy_t *policy) {
+  if (policy == nullptr) {
+    return -1;
+  }
+  return mesh::runtime().heap().setClassMeshPolicy(size_class, policy->enabled != 0, policy->occupancy_cutoff,
+                                                   policy->max_pairs_per_cycle);
+}
+
+// Free n pointers in one pass: pointers are grouped by backing
+// miniheap, each miniheap's occupancy bits are cleared with one
+// word-wise operation, and freelist classification happens once per
+// distinct miniheap instead of per object.  The array is not
+// modified.  NULL entries are skipped.
+void MESH_EXPORT mesh_free_batch(void **ptrs, size_t n) {
+  if (ptrs == nullptr || n == 0) {
+    return;
+  }
+  mesh::runtime().heap().freeBatchSorted(ptrs, n);
+}
+
+// Aggressively give memory back: flush caches, force a mesh cycle,
+// and scavenge, repeating until the internal RSS estimate drops to
+// target_rss_kb (0 = release everything reclaimable) or a round
+// makes no progress.  Returns the number of pages released.  Also
+// triggered by SIGTRIM (SIGRTMIN+9) when the background thread is
+// running.
+size_t MESH_EXPORT mesh_trim(size_t target_rss_kb) {
+  return mesh::runtime().heap().trim(target_rss_kb);
+}
+
+// Quiesce the heap and write a warm-restart snapshot into dir (the
+// span file, page index, miniheap metadata, and mesh state).  A
+// process started with MESH_RESTORE_DIR=<dir> resumes with the heap
+// contents already resident -- at the same arena address, so interior
+// pointers stay valid.  Returns 0 on success.
+int MESH_EXPORT mesh_snapshot(const char *dir) {
+  return mesh::runtime().heap().snapshot(dir);
+}
+
+// Exempt the miniheap (span of objects) backing ptr from meshing, so
+// write-hot structures stop paying relocation and TLB-shootdown
+// costs.  Pinning takes effect for future mesh cycles; a cycle
+// already in flight may still move the page.  Returns 0 on success,
+// -1 if ptr is not a mesh allocation.
+int MESH_EXPORT mesh_pin(void *ptr) {
+  return mesh::runtime().heap().pin(ptr, true);
+}
+
+int MESH_EXPORT mesh_unpin(void *ptr) {
+  return mesh::runtime().heap().pin(ptr, false);
+}
+
+// Write the sampled heap profile to `path` in the legacy pprof heap
+// format (symbolize with `pprof <binary> <path>`).  Sampling is
+// enabled with MESH_PROFILE_SAMPLE_BYTES=<n>; returns 0 on success.
+int MESH_EXPORT mesh_dump_heap_profile(const char *path) {
+  if (path == nullptr) {
+    return -1;
+  }
+  return mesh::HeapProfiler::dumpProfile(path);
+}
+
+// Fill *stats with a snapshot of allocator state; see plasma/mesh.h.
+// The caller sets stats->version so layout mismatches are refused
+// rather than scribbled over.
+int MESH_EXPORT mesh_introspect(mesh_introspect_t *stats) {
+  if (stats == nullptr || stats->version != MESH_INTROSPECT_VERSION) {
+    return -1;
+  }
+
+  auto &heap = mesh::runtime().heap();
+
+  heap.lock();
+  heap.introspectLocked(stats);
+  ThreadLocalHeap::AggregateStatsLocked(&stats->alloc_count, &stats->free_count);
+  heap.unlock();
+
+  return 0;
+}
+
+// Try to resize ptr's allocation to new_size without moving it.
+// Returns ptr on success (contents preserved) or NULL when the
+// allocation cannot be resized in place; ptr remains valid either
+// way.  Only page-backed allocations can actually grow.
+void MESH_EXPORT *mesh_realloc_in_place(void *ptr, size_t new_size) {
+  if (ptr == nullptr) {
+    return nullptr;
+  }
+  return mesh::runtime().heap().tryReallocInPlace(ptr, new_size) ? ptr : nullptr;
+}
+
+// Tune the mesh scheduler without recompiling.  When adaptive is
+// non-zero the period floats between [min_period_ms, max_period_ms]
+// -- aggressive while fragmentation climbs, dormant when the heap is
+// steady; otherwise mesh cycles run at a fixed min_period_ms.
+void MESH_EXPORT mesh_set_mesh_policy(size_t min_period_ms, size_t max_period_ms, int adaptive) {
+  mesh::runtime().setMeshPolicy(std::chrono::milliseconds{min_period_ms}, std::chrono::milliseconds{max_period_ms},
+                                adaptive != 0);
+}
+
 #ifdef __linux__
 
 int MESH_EXPORT epoll_wait(int __epfd, struct epoll_event *__events, int __maxevents, int __timeout) {
@@ -0,0 +1,60 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright 2020 The Mesh Authors. All rights reserved.
+// Use of this source code is governed by the Apache License,
+// Version 2.0, that can be found in the LICENSE file.
+
+#pragma once
+#ifndef MESH_MESH_ALLOC_H
+#define MESH_MESH_ALLOC_H
+
+// Compile-time size-class-specialized allocation, for container and
+// arena code that knows its sizes statically: the size class is
+// resolved via constexpr evaluation over the canonical class table,
+// so the fast path is an index into the thread's shuffle vectors with
+// no class_array_ lookup.
+
+#include "thread_local_heap.h"
+
+extern "C" {
+void *mesh_malloc(size_t sz);
+void mesh_free(void *ptr);
+}
+
+namespace mesh {
+
+template <size_t N>
+inline void *ATTRIBUTE_ALWAYS_INLINE alloc() {
+  constexpr int sizeClass = classForSize(N);
+  static_assert(sizeClass >= 0, "size has no class; use malloc for page-backed allocations");
+
+  ThreadLocalHeap *heap = ThreadLocalHeap::GetHeapIfPresent();
+  if (unlikely(heap == nullptr)) {
+    return mesh_malloc(N);
+  }
+
+  return heap->mallocInClass(static_cast<uint32_t>(sizeClass));
+}
+
+template <size_t N>
+inline void ATTRIBUTE_ALWAYS_INLINE free_sized(void *ptr) {
+  constexpr int sizeClass = classForSize(N);
+  static_assert(sizeClass >= 0, "size has no class; use free for page-backed allocations");
+
+  ThreadLocalHeap *heap = ThreadLocalHeap::GetHeapIfPresent();
+  if (unlikely(heap == nullptr)) {
+    mesh_free(ptr);
+    return;
+  }
+
+  heap->freeInClass(ptr, static_cast<uint32_t>(sizeClass));
+}
+
+// the byte capacity alloc<N>() actually returns
+template <size_t N>
+inline constexpr size_t allocSize() {
+  return static_cast<size_t>(kClassSizes[classForSize(N)]);
+}
+
+}  // namespace mesh
+
+#endif  // MESH_MESH_ALLOC_H
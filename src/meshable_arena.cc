@@ -18,6 +18,16 @@
 #include <linux/memfd.h>
 #endif
 
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <linux/userfaultfd.h>
+// write-protection support landed well after the base userfaultfd
+// API; only compile the uffd path against headers that have it.
+#if defined(UFFD_FEATURE_PAGEFAULT_FLAG_WP) && defined(UFFDIO_WRITEPROTECT)
+#define MESH_HAVE_UFFD_WP 1
+#endif
+#endif
+
 #include <sys/ioctl.h>
 
 #include <algorithm>
@@ -25,6 +35,8 @@
 #include "meshable_arena.h"
 #include "mini_heap.h"
 #include "runtime.h"
+#include "thread_local_heap.h"
+#include "tracepoints.h"
 
 namespace mesh {
 
@@ -35,27 +47,93 @@ static const char *const TMP_DIRS[] = {
     "/tmp",
 };
 
-MeshableArena::MeshableArena() : SuperHeap(), _fastPrng(internal::seed(), internal::seed()) {
+size_t MeshableArena::determineArenaSize() {
+  constexpr size_t kOneGb = 1024ULL * 1024ULL * 1024ULL;
+
+  const char *sizeStr = getenv("MESH_ARENA_SIZE_GB");
+  if (sizeStr == nullptr) {
+    return kDefaultArenaSize;
+  }
+
+  errno = 0;
+  const long gb = strtol(sizeStr, nullptr, 10);
+  if (errno != 0 || gb <= 0) {
+    debug("mesh: ignoring invalid MESH_ARENA_SIZE_GB '%s'\n", sizeStr);
+    return kDefaultArenaSize;
+  }
+
+  size_t size = static_cast<size_t>(gb) * kOneGb;
+  if (size > kArenaSize) {
+    debug("mesh: clamping MESH_ARENA_SIZE_GB to the compiled-in maximum of %zu GB\n", kArenaSize / kOneGb);
+    size = kArenaSize;
+  }
+
+  return size;
+}
+
+MeshableArena::MeshableArena() : SuperHeap(), _arenaSize(determineArenaSize()), _fastPrng(internal::seed(), internal::seed()) {
   d_assert(arenaInstance == nullptr);
   arenaInstance = this;
 
+  const char *numaStr = getenv("MESH_NUMA");
+  _numaAware = numaStr != nullptr && atoi(numaStr) != 0;
+
+  const char *hugetlbStr = getenv("MESH_HUGETLB");
+  _hugetlbRequested = kMeshingEnabled && hugetlbStr != nullptr && atoi(hugetlbStr) != 0;
+
+  const char *mergeableStr = getenv("MESH_MERGEABLE");
+  _mergeableRequested = mergeableStr != nullptr && atoi(mergeableStr) != 0;
+
+  // warm restart: map a previous process's heap back in before
+  // creating anything fresh
+  const char *restoreDir = kMeshingEnabled ? getenv("MESH_RESTORE_DIR") : nullptr;
+  if (restoreDir != nullptr && tryRestoreSnapshot(restoreDir)) {
+    hard_assert(_arenaBegin != nullptr);
+    hard_assert(_mhIndex != nullptr);
+
+    atexit(staticAtExit);
+    pthread_atfork(staticPrepareForFork, staticAfterForkParent, staticAfterForkChild);
+    return;
+  }
+
   int fd = -1;
   if (kMeshingEnabled) {
-    fd = openSpanFile(kArenaSize);
+    fd = openSpanFile(_arenaSize);
     if (fd < 0) {
       debug("mesh: opening arena file failed.\n");
       abort();
     }
   }
   _fd = fd;
-  _arenaBegin = SuperHeap::map(kArenaSize, kMapShared, fd);
+  // only _arenaSize is reserved; the metadata below is sized for the
+  // compile-time maximum but MAP_NORESERVE'd, so untouched chunks of
+  // it cost address space, not memory
+  _arenaBegin = SuperHeap::map(_arenaSize, kMapShared, fd);
   _mhIndex = reinterpret_cast<atomic<MiniHeapID> *>(SuperHeap::malloc(indexSize()));
 
   hard_assert(_arenaBegin != nullptr);
   hard_assert(_mhIndex != nullptr);
 
   if (kAdviseDump) {
-    madvise(_arenaBegin, kArenaSize, MADV_DONTDUMP);
+    madvise(_arenaBegin, _arenaSize, MADV_DONTDUMP);
+  }
+
+  if (unlikely(_mergeableRequested)) {
+    if (!kMeshingEnabled) {
+      // cross-process dedupe of identical read-mostly pages: hand the
+      // (anonymous, private) arena to KSM, which merges identical
+      // pages across our worker fleet and COW-faults them back to
+      // private pages on write -- exactly the requested semantics,
+      // provided by the kernel.  Within-process meshing is off in
+      // this configuration, so the two mechanisms never fight over a
+      // page.
+      madvise(_arenaBegin, _arenaSize, MADV_MERGEABLE);
+    } else {
+      // with meshing enabled the arena is a MAP_SHARED file mapping,
+      // which KSM will not touch and which has no copy-on-write to
+      // fault back to; see the discussion on finalizeMesh
+      debug("mesh: MESH_MERGEABLE requires the meshing-disabled build; ignoring\n");
+    }
   }
 
   // debug("MeshableArena(%p): fd:%4d\t%p-%p\n", this, fd, _arenaBegin, arenaEnd());
@@ -132,115 +210,186 @@ char *MeshableArena::openSpanDir(int pid) {
   return nullptr;
 }
 
-void MeshableArena::expandArena(size_t minPagesAdded) {
-  const size_t pageCount = std::max(minPagesAdded, kMinArenaExpansion);
-
-  Span expansion(_end, pageCount);
-  _end += pageCount;
+void MeshableArena::bindExpansionToLocalNode(const Span &span) {
+#if defined(__linux__) && defined(__NR_mbind) && defined(__NR_getcpu)
+  if (likely(!_numaAware)) {
+    return;
+  }
 
-  if (unlikely(_end >= kArenaSize / kPageSize)) {
-    debug("Mesh: arena exhausted: current arena size is %.1f GB; recompile with larger arena size.",
-          kArenaSize / 1024.0 / 1024.0 / 1024.0);
-    abort();
+  unsigned int cpu = 0;
+  unsigned int node = 0;
+  if (syscall(__NR_getcpu, &cpu, &node, nullptr) != 0) {
+    return;
   }
 
-  _clean[expansion.spanClass()].push_back(expansion);
+  // prefer (not require) the requesting thread's node: first-touch
+  // stays local even when a different thread later faults the tail of
+  // the chunk, and the kernel can still fall back under pressure
+  unsigned long nodemask = 1UL << node;
+  syscall(__NR_mbind, ptrFromOffset(span.offset), span.byteLength(), MPOL_PREFERRED, &nodemask,
+          sizeof(nodemask) * 8, 0);
+#else
+  (void)span;
+#endif
 }
 
-bool MeshableArena::findPagesInner(internal::vector<Span> freeSpans[kSpanClassCount], const size_t i,
-                                   const size_t pageCount, Span &result) {
-  internal::vector<Span> &spanList = freeSpans[i];
-  if (spanList.empty())
-    return false;
-
-  size_t oldLen = spanList.size();
+#ifdef USE_MEMFD
+static int sys_memfd_create(const char *name, unsigned int flags);
+#endif
 
-  if (i == kSpanClassCount - 1 && spanList.back().length < pageCount) {
-    // the final span class contains (and is the only class to
-    // contain) variable-size spans, so we need to make sure we
-    // search through all candidates in this case.
-    for (size_t j = 0; j < spanList.size() - 1; j++) {
-      if (spanList[j].length >= pageCount) {
-        std::swap(spanList[j], spanList.back());
-        break;
-      }
-    }
+bool MeshableArena::tryBackWithHugetlb(const Span &span) {
+#if defined(USE_MEMFD) && defined(MFD_HUGETLB)
+  if (!_hugetlbRequested) {
+    return false;
+  }
 
-    // check that we found something in the above loop. this would be
-    // our last loop iteration anyway
-    if (spanList.back().length < pageCount) {
+  if (_hugetlbFd < 0) {
+    _hugetlbFd = sys_memfd_create("mesh_hugetlb", MFD_CLOEXEC | MFD_HUGETLB);
+    if (_hugetlbFd < 0) {
+      debug("mesh: MFD_HUGETLB unavailable (%s), falling back to THP\n", strerror(errno));
+      _hugetlbRequested = false;
       return false;
     }
   }
 
-  Span span = spanList.back();
-  spanList.pop_back();
+  const off_t fileOff = _hugetlbEnd;
+  const size_t len = span.byteLength();
+  if (ftruncate(_hugetlbFd, fileOff + static_cast<off_t>(len)) != 0) {
+    return false;
+  }
 
-#ifndef NDEBUG
-  d_assert_msg(oldLen == spanList.size() + 1, "pageCount:%zu,%zu -- %zu/%zu", pageCount, i, oldLen, spanList.size());
-  for (size_t j = 0; j < spanList.size(); j++) {
-    d_assert(spanList[j] != span);
+  void *addr = mmap(ptrFromOffset(span.offset), len, HL_MMAP_PROTECTION_MASK, MAP_SHARED | MAP_FIXED, _hugetlbFd,
+                    fileOff);
+  if (addr == MAP_FAILED) {
+    // most likely no reserved huge pages; stay on the THP path and
+    // don't try again
+    debug("mesh: hugetlb mmap failed (%s), falling back to THP\n", strerror(errno));
+    _hugetlbRequested = false;
+    return false;
   }
-#endif
 
-  // this invariant should be maintained
-  d_assert(span.length >= i + 1);
-  d_assert(span.length >= pageCount);
+  _hugetlbEnd = fileOff + static_cast<off_t>(len);
+  _hugetlbSpans.push_back(std::make_pair(span, fileOff));
+  return true;
+#else
+  (void)span;
+  return false;
+#endif
+}
 
-  // put the part we don't need back in the reuse pile
-  Span rest = span.splitAfter(pageCount);
-  if (!rest.empty()) {
-    freeSpans[rest.spanClass()].push_back(rest);
+off_t MeshableArena::hugetlbOffsetFor(const void *ptr, size_t sz) const {
+  if (likely(_hugetlbSpans.empty())) {
+    return -1;
   }
-  d_assert(span.length == pageCount);
 
-  result = span;
-  return true;
+  const auto off = offsetFor(ptr);
+  for (auto const &entry : _hugetlbSpans) {
+    const Span &span = entry.first;
+    if (span.offset <= off && off + sz / kPageSize <= span.offset + span.length) {
+      return entry.second + static_cast<off_t>(off - span.offset) * static_cast<off_t>(kPageSize);
+    }
+  }
+  return -1;
 }
 
-bool MeshableArena::findPages(const size_t pageCount, Span &result, internal::PageType &type) {
-  // Search through all dirty spans first.  We don't worry about
-  // fragmenting dirty pages, as being able to reuse dirty pages means
-  // we don't increase RSS.
-  for (size_t i = Span(0, pageCount).spanClass(); i < kSpanClassCount; i++) {
-    if (findPagesInner(_dirty, i, pageCount, result)) {
-      type = internal::PageType::Dirty;
-      return true;
+void MeshableArena::expandArena(size_t minPagesAdded, bool huge) {
+  if (huge) {
+    constexpr Length kHugePages = kHugePageSize / kPageSize;
+
+    // align the chunk to 2MB so the kernel can actually back it with
+    // huge pages; the alignment gap is perfectly good 4KB-tier memory
+    const Offset alignedBegin = (_end + kHugePages - 1) & ~(kHugePages - 1);
+    if (alignedBegin > _end) {
+      Span gap(_end, alignedBegin - _end);
+      _clean.insert(gap);
     }
+
+    const size_t pageCount = ((std::max(minPagesAdded, static_cast<size_t>(kHugePages)) + kHugePages - 1) /
+                              kHugePages) *
+                             kHugePages;
+
+    Span expansion(alignedBegin, pageCount);
+    _end = alignedBegin + pageCount;
+
+    if (unlikely(_end >= _arenaSize / kPageSize)) {
+      debug("Mesh: arena exhausted: current arena size is %.1f GB; set MESH_ARENA_SIZE_GB higher.",
+            _arenaSize / 1024.0 / 1024.0 / 1024.0);
+      abort();
+    }
+
+    // real hugetlb pages when requested and available; otherwise ask
+    // the kernel for transparent ones
+    if (!tryBackWithHugetlb(expansion)) {
+      madvise(ptrFromOffset(expansion.offset), expansion.byteLength(), MADV_HUGEPAGE);
+    }
+    for (size_t i = 0; i < expansion.length; i++) {
+      _hugeBitmap.tryToSet(expansion.offset + i);
+    }
+
+    bindExpansionToLocalNode(expansion);
+    _cleanHuge.insert(expansion);
+    return;
+  }
+
+  const size_t pageCount = std::max(minPagesAdded, kMinArenaExpansion);
+
+  Span expansion(_end, pageCount);
+  _end += pageCount;
+
+  if (unlikely(_end >= _arenaSize / kPageSize)) {
+    debug("Mesh: arena exhausted: current arena size is %.1f GB; set MESH_ARENA_SIZE_GB higher.",
+          _arenaSize / 1024.0 / 1024.0 / 1024.0);
+    abort();
+  }
+
+  bindExpansionToLocalNode(expansion);
+  _clean.insert(expansion);
+}
+
+bool MeshableArena::findPages(const size_t pageCount, Span &result, internal::PageType &type, bool huge) {
+  hard_assert(pageCount <= std::numeric_limits<Length>::max());
+
+  // Search dirty spans first.  We don't worry about fragmenting dirty
+  // pages, as being able to reuse dirty pages means we don't increase
+  // RSS.
+  if ((huge ? _dirtyHuge : _dirty).take(static_cast<Length>(pageCount), result)) {
+    type = internal::PageType::Dirty;
+    return true;
   }
 
   // if no dirty pages are available, search clean pages.  An allocated
   // clean page (once it is written to) means an increased RSS.
-  for (size_t i = Span(0, pageCount).spanClass(); i < kSpanClassCount; i++) {
-    if (findPagesInner(_clean, i, pageCount, result)) {
-      type = internal::PageType::Clean;
-      return true;
-    }
+  if ((huge ? _cleanHuge : _clean).take(static_cast<Length>(pageCount), result)) {
+    type = internal::PageType::Clean;
+    return true;
   }
 
   return false;
 }
 
-Span MeshableArena::reservePages(const size_t pageCount, const size_t pageAlignment) {
+Span MeshableArena::reservePages(const size_t pageCount, const size_t pageAlignment, bool huge,
+                                 internal::PageType &type) {
   d_assert(pageCount >= 1);
 
-  internal::PageType flags(internal::PageType::Unknown);
+  type = internal::PageType::Unknown;
   Span result(0, 0);
-  auto ok = findPages(pageCount, result, flags);
+  auto ok = findPages(pageCount, result, type, huge);
   if (!ok) {
-    expandArena(pageCount);
-    ok = findPages(pageCount, result, flags);
+    expandArena(pageCount, huge);
+    ok = findPages(pageCount, result, type, huge);
     hard_assert(ok);
   }
 
   d_assert(!result.empty());
-  d_assert(flags != internal::PageType::Unknown);
+  d_assert(type != internal::PageType::Unknown);
 
   if (unlikely(pageAlignment > 1 && ((ptrvalFromOffset(result.offset) / kPageSize) % pageAlignment != 0))) {
-    freeSpan(result, flags);
+    freeSpan(result, type);
     // recurse once, asking for enough extra space that we are sure to
     // be able to find an aligned offset of pageCount pages within.
-    result = reservePages(pageCount + 2 * pageAlignment, 1);
+    // `type` now describes the span this recursion actually returned,
+    // so the excess below goes back on the list it came from.
+    result = reservePages(pageCount + 2 * pageAlignment, 1, huge, type);
 
     const size_t alignment = pageAlignment * kPageSize;
     const uintptr_t alignedPtr = (ptrvalFromOffset(result.offset) + alignment - 1) & ~(alignment - 1);
@@ -250,28 +399,15 @@ Span MeshableArena::reservePages(const size_t pageCount, const size_t pageAlignm
     const auto unwantedPageCount = alignedOff - result.offset;
     auto alignedResult = result.splitAfter(unwantedPageCount);
     d_assert(alignedResult.offset == alignedOff);
-    freeSpan(result, flags);
+    freeSpan(result, type);
     const auto excess = alignedResult.splitAfter(pageCount);
-    freeSpan(excess, flags);
+    freeSpan(excess, type);
     result = alignedResult;
   }
 
   return result;
 }
 
-template <typename Func>
-static void forEachFree(const internal::vector<Span> freeSpans[kSpanClassCount], const Func func) {
-  for (size_t i = 0; i < kSpanClassCount; i++) {
-    if (freeSpans[i].empty())
-      continue;
-
-    for (size_t j = 0; j < freeSpans[i].size(); j++) {
-      auto span = freeSpans[i][j];
-      func(span);
-    }
-  }
-}
-
 internal::RelaxedBitmap MeshableArena::allocatedBitmap(bool includeDirty) const {
   internal::RelaxedBitmap bitmap(_end);
 
@@ -293,14 +429,17 @@ internal::RelaxedBitmap MeshableArena::allocatedBitmap(bool includeDirty) const
     }
   };
 
-  if (includeDirty)
-    forEachFree(_dirty, unmarkPages);
-  forEachFree(_clean, unmarkPages);
+  if (includeDirty) {
+    _dirty.forEach(unmarkPages);
+    _dirtyHuge.forEach(unmarkPages);
+  }
+  _clean.forEach(unmarkPages);
+  _cleanHuge.forEach(unmarkPages);
 
   return bitmap;
 }
 
-char *MeshableArena::pageAlloc(Span &result, size_t pageCount, size_t pageAlignment) {
+char *MeshableArena::pageAlloc(Span &result, size_t pageCount, size_t pageAlignment, bool hugeEligible, bool *zeroed) {
   if (pageCount == 0) {
     return nullptr;
   }
@@ -310,7 +449,18 @@ char *MeshableArena::pageAlloc(Span &result, size_t pageCount, size_t pageAlignm
   d_assert(pageCount >= 1);
   d_assert(pageCount < std::numeric_limits<Length>::max());
 
-  auto span = reservePages(pageCount, pageAlignment);
+  internal::PageType type(internal::PageType::Unknown);
+  auto span = reservePages(pageCount, pageAlignment, hugeEligible, type);
+  if (type == internal::PageType::Clean) {
+    // these pages will be faulted in as the caller touches them
+    _committedPageEstimate.fetch_add(span.length, std::memory_order_relaxed);
+  }
+  if (zeroed != nullptr) {
+    // clean spans have never been written since expansion, or have
+    // been hole-punched from the span file and madvised away -- both
+    // fault back in as zero pages
+    *zeroed = type == internal::PageType::Clean;
+  }
   d_assert(isAligned(span, pageAlignment));
 
   d_assert(contains(ptrFromOffset(span.offset)));
@@ -332,6 +482,26 @@ char *MeshableArena::pageAlloc(Span &result, size_t pageCount, size_t pageAlignm
   return ptr;
 }
 
+bool MeshableArena::tryExtendSpan(const Span &span, Length extraPages) {
+  d_assert(extraPages > 0);
+
+  const Offset want = span.offset + span.length;
+  const bool huge = isHugeSpan(span);
+
+  // prefer dirty pages, as with findPages: reusing them doesn't
+  // increase RSS
+  if ((huge ? _dirtyHuge : _dirty).claimRange(want, extraPages)) {
+    d_assert(_dirtyPageCount >= extraPages);
+    _dirtyPageCount -= extraPages;
+    return true;
+  }
+  if ((huge ? _cleanHuge : _clean).claimRange(want, extraPages)) {
+    _committedPageEstimate.fetch_add(extraPages, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
 void MeshableArena::free(void *ptr, size_t sz, internal::PageType type) {
   if (unlikely(!contains(ptr))) {
     debug("invalid free of %p/%zu", ptr, sz);
@@ -346,30 +516,137 @@ void MeshableArena::free(void *ptr, size_t sz, internal::PageType type) {
   freeSpan(span, type);
 }
 
-void MeshableArena::partialScavenge() {
-  forEachFree(_dirty, [&](const Span &span) {
-    auto ptr = ptrFromOffset(span.offset);
-    auto sz = span.byteLength();
-    madvise(ptr, sz, MADV_DONTNEED);
-    freePhys(ptr, sz);
-    // don't coalesce, just add to clean
-    _clean[span.spanClass()].push_back(span);
-  });
-
-  for (size_t i = 0; i < kSpanClassCount; i++) {
-    _dirty[i].clear();
-    internal::vector<Span> empty{};
-    _dirty[i].swap(empty);
+void MeshableArena::madviseDontNeed(const struct iovec *iov, size_t count) {
+  if (count == 0) {
+    return;
   }
 
+#ifdef __NR_process_madvise
+  if (likely(_pidFd != -1)) {
+    if (unlikely(_pidFd == -2)) {
+#ifdef __NR_pidfd_open
+      _pidFd = static_cast<int>(syscall(__NR_pidfd_open, getpid(), 0));
+#else
+      _pidFd = -1;
+#endif
+    }
+
+    if (_pidFd >= 0) {
+      size_t totalLen = 0;
+      for (size_t i = 0; i < count; i++) {
+        totalLen += iov[i].iov_len;
+      }
+
+      const ssize_t advised = syscall(__NR_process_madvise, _pidFd, iov, count, MADV_DONTNEED, 0);
+      if (likely(advised == static_cast<ssize_t>(totalLen))) {
+        return;
+      }
+
+      if (advised < 0 && (errno == ENOSYS || errno == EPERM || errno == EINVAL)) {
+        // kernel too old (or seccomp'd); don't probe again
+        close(_pidFd);
+        _pidFd = -1;
+      }
+      // partial success or transient failure: re-advising a range is
+      // harmless, so just fall through to the per-range loop
+    }
+  }
+#endif
+
+  for (size_t i = 0; i < count; i++) {
+    madvise(iov[i].iov_base, iov[i].iov_len, MADV_DONTNEED);
+  }
+}
+
+void MeshableArena::partialScavenge() {
+  struct iovec iov[kMadviseBatchSize];
+  size_t iovLen = 0;
+
+  auto drain = [&](SpanSet &dirty, SpanSet &clean) {
+    dirty.forEach([&](const Span &span) {
+      auto ptr = ptrFromOffset(span.offset);
+      auto sz = span.byteLength();
+
+      // spans come out offset-sorted, so physically adjacent ranges
+      // merge into one iovec entry
+      if (iovLen > 0 && reinterpret_cast<char *>(iov[iovLen - 1].iov_base) + iov[iovLen - 1].iov_len == ptr) {
+        iov[iovLen - 1].iov_len += sz;
+      } else {
+        if (iovLen == kMadviseBatchSize) {
+          madviseDontNeed(iov, iovLen);
+          iovLen = 0;
+        }
+        iov[iovLen].iov_base = ptr;
+        iov[iovLen].iov_len = sz;
+        iovLen++;
+      }
+
+      freePhys(ptr, sz);
+      clean.insert(span);
+    });
+    dirty.clear();
+  };
+
+  drain(_dirty, _clean);
+  drain(_dirtyHuge, _cleanHuge);
+
+  madviseDontNeed(iov, iovLen);
+
   _dirtyPageCount = 0;
 }
 
+size_t MeshableArena::scavengeBatch(size_t maxPages) {
+  size_t released = 0;
+
+  MESH_PROBE2(scavenge_begin, 0, _dirtyPageCount);
+
+  // drain the largest spans first; each one costs a single madvise +
+  // hole punch no matter how many pages it covers
+  struct iovec iov[kMadviseBatchSize];
+  size_t iovLen = 0;
+
+  auto drain = [&](SpanSet &dirty, SpanSet &clean) {
+    Span span(0, 0);
+    while (released < maxPages && dirty.takeLargest(span)) {
+      auto ptr = ptrFromOffset(span.offset);
+      auto sz = span.byteLength();
+
+      if (iovLen == kMadviseBatchSize) {
+        madviseDontNeed(iov, iovLen);
+        iovLen = 0;
+      }
+      iov[iovLen].iov_base = ptr;
+      iov[iovLen].iov_len = sz;
+      iovLen++;
+
+      freePhys(ptr, sz);
+      clean.insert(span);
+
+      released += span.length;
+    }
+  };
+
+  drain(_dirty, _clean);
+  drain(_dirtyHuge, _cleanHuge);
+
+  madviseDontNeed(iov, iovLen);
+
+  d_assert(_dirtyPageCount >= released);
+  _dirtyPageCount -= released;
+
+  MESH_PROBE1(scavenge_end, released);
+
+  return released;
+}
+
 void MeshableArena::scavenge(bool force) {
   if (!force && _dirtyPageCount < kMinDirtyPageThreshold) {
     return;
   }
 
+  MESH_PROBE2(scavenge_begin, force, _dirtyPageCount);
+  const size_t dirtyAtStart = _dirtyPageCount;
+
   // the inverse of the allocated bitmap is all of the spans in _clear
   // (since we just MADV_DONTNEED'ed everything in dirty)
   auto bitmap = allocatedBitmap(false);
@@ -386,62 +663,116 @@ void MeshableArena::scavenge(bool force) {
     }
   };
 
-  // first, untrack the spans in the meshed bitmap and mark them in
-  // the (method-local) unallocated bitmap
-  std::for_each(_toReset.begin(), _toReset.end(), [&](Span span) {
+  // restore identity mappings for freed meshed spans.  Sorting by
+  // offset lets physically contiguous spans collapse into a single
+  // MAP_FIXED mmap (each one is a TLB-shootdown-inducing syscall),
+  // and per-cycle work is capped with carryover so an un-mesh burst
+  // doesn't stall this scavenge behind thousands of remaps.
+  std::sort(_toReset.begin(), _toReset.end(), [](const Span &a, const Span &b) { return a.offset < b.offset; });
+
+  size_t resetCalls = 0;
+  size_t consumed = 0;
+  Span run(0, 0);
+
+  for (size_t i = 0; i < _toReset.size(); i++) {
+    const Span span = _toReset[i];
+
+    if (run.empty()) {
+      run = span;
+    } else if (span.offset == run.offset + run.length) {
+      run.length += span.length;
+    } else {
+      resetSpanMapping(run);
+      resetCalls++;
+      if (resetCalls >= kMaxSpanResetsPerScavenge) {
+        run = Span(0, 0);
+        break;
+      }
+      run = span;
+    }
+
     untrackMeshed(span);
     markPages(span);
-    resetSpanMapping(span);
-  });
+    consumed = i + 1;
+  }
 
-  // now that we've finally reset to identity all delayed-reset
-  // mappings, empty the list
-  _toReset.clear();
-  {
-    // force freeing our internal allocations
+  if (!run.empty()) {
+    resetSpanMapping(run);
+  }
+
+  if (consumed == _toReset.size()) {
+    // fully drained: also release the vector's own allocation
+    _toReset.clear();
     internal::vector<Span> empty{};
     _toReset.swap(empty);
+  } else {
+    // carry the unreset tail over to the next scavenge
+    _toReset.erase(_toReset.begin(), _toReset.begin() + consumed);
   }
 
   _meshedPageCount = _meshedBitmap.inUseCount();
   if (_meshedPageCount > _meshedPageCountHWM) {
     _meshedPageCountHWM = _meshedPageCount;
-    // TODO: find rss at peak
+    _rssKbAtHWM = rssKbEstimate();
   }
 
-  forEachFree(_dirty, [&](const Span &span) {
-    auto ptr = ptrFromOffset(span.offset);
-    auto sz = span.byteLength();
-    madvise(ptr, sz, MADV_DONTNEED);
-    freePhys(ptr, sz);
-    markPages(span);
-  });
+  {
+    struct iovec iov[kMadviseBatchSize];
+    size_t iovLen = 0;
 
-  for (size_t i = 0; i < kSpanClassCount; i++) {
-    _dirty[i].clear();
-    internal::vector<Span> empty{};
-    _dirty[i].swap(empty);
+    auto drain = [&](SpanSet &dirty) {
+      dirty.forEach([&](const Span &span) {
+        auto ptr = ptrFromOffset(span.offset);
+        auto sz = span.byteLength();
+
+        if (iovLen > 0 && reinterpret_cast<char *>(iov[iovLen - 1].iov_base) + iov[iovLen - 1].iov_len == ptr) {
+          iov[iovLen - 1].iov_len += sz;
+        } else {
+          if (iovLen == kMadviseBatchSize) {
+            madviseDontNeed(iov, iovLen);
+            iovLen = 0;
+          }
+          iov[iovLen].iov_base = ptr;
+          iov[iovLen].iov_len = sz;
+          iovLen++;
+        }
+
+        freePhys(ptr, sz);
+        markPages(span);
+      });
+    };
+
+    drain(_dirty);
+    drain(_dirtyHuge);
+
+    madviseDontNeed(iov, iovLen);
   }
 
+  _dirty.clear();
+  _dirtyHuge.clear();
+
   _dirtyPageCount = 0;
 
-  for (size_t i = 0; i < kSpanClassCount; i++) {
-    _clean[i].clear();
-    internal::vector<Span> empty{};
-    _clean[i].swap(empty);
-  }
+  _clean.clear();
+  _cleanHuge.clear();
+
+  // rebuild the clean sets from the free-page bitmap.  SpanSet
+  // coalesces on insert, but a run must still break at a tier
+  // boundary so huge-tier pages never end up on the 4KB-tier set.
+  auto pushClean = [&](const Span &span) {
+    (isHugeSpan(span) ? _cleanHuge : _clean).insert(span);
+  };
 
-  // coalesce adjacent spans
   Span current(0, 0);
   for (auto const &i : bitmap) {
-    if (i == current.offset + current.length) {
+    if (i == current.offset + current.length && _hugeBitmap.isSet(i) == _hugeBitmap.isSet(current.offset)) {
       current.length++;
       continue;
     }
 
     // should only be empty the first time/iteration through
     if (!current.empty()) {
-      _clean[current.spanClass()].push_back(current);
+      pushClean(current);
       // debug("  clean: %4zu/%4zu\n", current.offset, current.length);
     }
 
@@ -450,7 +781,7 @@ void MeshableArena::scavenge(bool force) {
 
   // should only be empty the first time/iteration through
   if (!current.empty()) {
-    _clean[current.spanClass()].push_back(current);
+    pushClean(current);
     // debug("  clean: %4zu/%4zu\n", current.offset, current.length);
   }
 #ifndef NDEBUG
@@ -468,6 +799,38 @@ void MeshableArena::scavenge(bool force) {
     }
   }
 #endif
+
+  MESH_PROBE1(scavenge_end, dirtyAtStart);
+}
+
+void MeshableArena::updateVmaBudget() {
+  const int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+
+  char buf[4096];
+  size_t lines = 0;
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] == '\n') {
+        lines++;
+      }
+    }
+  }
+  close(fd);
+
+  _processMapCount = lines;
+  _meshVmasSinceMeasure = 0;
+}
+
+void MeshableArena::calibrateCommittedEstimate() {
+  const size_t pssKb = internal::measurePssKiB();
+  if (pssKb == 0) {
+    return;
+  }
+  _committedPageEstimate.store(pssKb / (kPageSize / 1024), std::memory_order_relaxed);
 }
 
 void MeshableArena::freePhys(void *ptr, size_t sz) {
@@ -477,6 +840,14 @@ void MeshableArena::freePhys(void *ptr, size_t sz) {
   d_assert(sz / CPUInfo::PageSize > 0);
   d_assert(sz % CPUInfo::PageSize == 0);
 
+  // the backing pages are being released (madvise and/or hole punch);
+  // saturate rather than underflow, since the estimate is approximate
+  const size_t pages = sz / kPageSize;
+  size_t current = _committedPageEstimate.load(std::memory_order_relaxed);
+  while (!_committedPageEstimate.compare_exchange_weak(current, current > pages ? current - pages : 0,
+                                                       std::memory_order_relaxed, std::memory_order_relaxed)) {
+  }
+
   // we madvise(MADV_DONTNEED) elsewhere; this function is only needed
   // when our heap is a shared mapping
   if (!kMeshingEnabled) {
@@ -485,6 +856,13 @@ void MeshableArena::freePhys(void *ptr, size_t sz) {
 
   const off_t off = reinterpret_cast<char *>(ptr) - reinterpret_cast<char *>(_arenaBegin);
 #ifndef __APPLE__
+  const off_t hugetlbOff = hugetlbOffsetFor(ptr, sz);
+  if (unlikely(hugetlbOff >= 0)) {
+    // hugetlb-backed chunk: its pages live in the hugetlb memfd, not
+    // the span file
+    fallocate(_hugetlbFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, hugetlbOff, sz);
+    return;
+  }
   int result = fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, sz);
   d_assert_msg(result == 0, "result(fd %d): %d errno %d (%s)\n", _fd, result, errno, strerror(errno));
 #else
@@ -503,12 +881,82 @@ void MeshableArena::freePhys(void *ptr, size_t sz) {
 #endif
 }
 
+bool MeshableArena::tryInitUffd() {
+  _uffdInitAttempted = true;
+
+#ifdef MESH_HAVE_UFFD_WP
+  if (!kMeshingEnabled) {
+    return false;
+  }
+
+  errno = 0;
+  int fd = static_cast<int>(syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+  if (fd < 0) {
+    return false;
+  }
+
+  struct uffdio_api ufApi = {};
+  ufApi.api = UFFD_API;
+  ufApi.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+  if (ioctl(fd, UFFDIO_API, &ufApi) == -1 || !(ufApi.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+    close(fd);
+    return false;
+  }
+
+  // ranges are registered per-mesh in beginMesh rather than arena-wide
+  // here: finalizeMesh's MAP_FIXED remap silently unregisters whatever
+  // it covers, so a one-time registration would erode span by span.
+  // The first beginMesh probes whether the kernel actually supports WP
+  // on our shared file mapping (5.19+) and disables uffd if not.
+  _uffd = fd;
+  return true;
+#else
+  return false;
+#endif
+}
+
 void MeshableArena::beginMesh(void *keep, void *remove, size_t sz) {
+  MESH_PROBE3(mesh_begin, keep, remove, sz / kPageSize);
+
+#ifdef MESH_HAVE_UFFD_WP
+  if (unlikely(!_uffdInitAttempted)) {
+    tryInitUffd();
+  }
+
+  if (_uffd >= 0) {
+    // a mutator writing one of these pages now blocks in the kernel
+    // until finalizeMesh wakes it, instead of spinning through the
+    // SIGSEGV handler until the whole mesh cycle finishes.
+    struct uffdio_register ufRegister = {};
+    ufRegister.range.start = reinterpret_cast<unsigned long>(remove);
+    ufRegister.range.len = sz;
+    ufRegister.mode = UFFDIO_REGISTER_MODE_WP;
+
+    struct uffdio_writeprotect ufWriteProtect = {};
+    ufWriteProtect.range.start = reinterpret_cast<unsigned long>(remove);
+    ufWriteProtect.range.len = sz;
+    ufWriteProtect.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+
+    if (likely(ioctl(_uffd, UFFDIO_REGISTER, &ufRegister) == 0 &&
+               ioctl(_uffd, UFFDIO_WRITEPROTECT, &ufWriteProtect) == 0)) {
+      return;
+    }
+
+    // the kernel refused; permanently fall back so that beginMesh and
+    // finalizeMesh always agree on which mechanism is in use.
+    debug("mesh: uffd write-protect failed (%s), disabling uffd meshing\n", strerror(errno));
+    close(_uffd);
+    _uffd = -1;
+  }
+#endif
+
   int r = mprotect(remove, sz, PROT_READ);
   hard_assert(r == 0);
 }
 
 void MeshableArena::finalizeMesh(void *keep, void *remove, size_t sz) {
+  MESH_PROBE3(mesh_finalize, keep, remove, sz / kPageSize);
+
   // debug("keep: %p, remove: %p\n", keep, remove);
   const auto keepOff = offsetFor(keep);
   const auto removeOff = offsetFor(remove);
@@ -526,6 +974,20 @@ void MeshableArena::finalizeMesh(void *keep, void *remove, size_t sz) {
   void *ptr = mmap(remove, sz, HL_MMAP_PROTECTION_MASK, kMapShared | MAP_FIXED, _fd, keepOff * kPageSize);
   hard_assert_msg(ptr != MAP_FAILED, "mesh remap failed: %d", errno);
 
+  // feed the live VMA budget: this remap can split a mapping
+  _meshVmasSinceMeasure++;
+
+#ifdef MESH_HAVE_UFFD_WP
+  if (_uffd >= 0) {
+    // the remap above dropped the uffd registration for this range,
+    // which releases most waiters; wake any stragglers explicitly.
+    // EINVAL is expected here (the range is no longer registered).
+    struct uffdio_range ufRange = {};
+    ufRange.start = reinterpret_cast<unsigned long>(remove);
+    ufRange.len = sz;
+    ioctl(_uffd, UFFDIO_WAKE, &ufRange);
+  }
+#endif
 }
 
 int MeshableArena::openShmSpanFile(size_t sz) {
@@ -576,7 +1038,11 @@ static int sys_memfd_create(const char *name, unsigned int flags) {
 
 int MeshableArena::openSpanFile(size_t sz) {
   errno = 0;
+#ifdef MFD_ALLOW_SEALING
+  int fd = sys_memfd_create("mesh_arena", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
   int fd = sys_memfd_create("mesh_arena", MFD_CLOEXEC);
+#endif
   // the call to memfd failed -- fall back to opening a shm file
   if (fd < 0) {
     return openShmSpanFile(sz);
@@ -588,6 +1054,13 @@ int MeshableArena::openSpanFile(size_t sz) {
     abort();
   }
 
+#if defined(F_ADD_SEALS) && defined(F_SEAL_SHRINK)
+  // a shrink of the span file out from under our mappings would turn
+  // every access into SIGBUS; seal it off.  Growth (and hole
+  // punching) remain allowed.
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK);
+#endif
+
   return fd;
 }
 #else
@@ -627,7 +1100,7 @@ void MeshableArena::prepareForFork() {
   runtime().lock();
   internal::Heap().lock();
 
-  int r = mprotect(_arenaBegin, kArenaSize, PROT_READ);
+  int r = mprotect(_arenaBegin, _arenaSize, PROT_READ);
   hard_assert(r == 0);
 
   int err = pipe(_forkPipe);
@@ -662,7 +1135,7 @@ void MeshableArena::afterForkParent() {
 
   // only after the child has finished copying the heap is it safe to
   // go back to read/write
-  int r = mprotect(_arenaBegin, kArenaSize, PROT_READ | PROT_WRITE);
+  int r = mprotect(_arenaBegin, _arenaSize, PROT_READ | PROT_WRITE);
   hard_assert(r == 0);
 
   // debug("%d: after fork parent", getpid());
@@ -670,6 +1143,336 @@ void MeshableArena::afterForkParent() {
   runtime().heap().unlock();
 }
 
+// copy one extent of the span file, preferring copy_file_range (which
+// can reflink or copy in-kernel) and falling back to sendfile.
+static void copyFileExtent(int dstFd, int srcFd, off_t off, size_t len) {
+#ifdef __NR_copy_file_range
+  static bool cfrSupported = true;
+
+  if (cfrSupported) {
+    loff_t offIn = off;
+    loff_t offOut = off;
+    while (len > 0) {
+      const ssize_t n = syscall(__NR_copy_file_range, srcFd, &offIn, dstFd, &offOut, len, 0);
+      if (n <= 0) {
+        if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EBADF)) {
+          cfrSupported = false;
+        }
+        break;
+      }
+      len -= n;
+    }
+    if (len == 0) {
+      return;
+    }
+    off = offIn;
+  }
+#endif
+
+  while (len > 0) {
+    const int result = internal::copyFile(dstFd, srcFd, off, len);
+    hard_assert(result > 0);
+    off += result;
+    len -= static_cast<size_t>(result);
+  }
+}
+
+
+// --- heap snapshot / warm restart -----------------------------------
+
+namespace {
+struct SnapshotManifest {
+  static constexpr uint64_t kMagic = 0x4d45534853485054ULL;  // "MESHSHPT"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t unused;
+  uint64_t arenaBegin;
+  uint64_t arenaSize;
+  uint64_t endPage;
+  uint64_t mhArenaOffset;
+};
+
+// build "dir/name" without snprintf (which may malloc)
+void snapshotPath(char *buf, size_t bufLen, const char *dir, const char *name) {
+  hard_assert(strlen(dir) + strlen(name) + 2 < bufLen);
+  buf[0] = '\0';
+  strcat(buf, dir);
+  strcat(buf, "/");
+  strcat(buf, name);
+}
+
+bool writeAll(int fd, const void *data, size_t len) {
+  const char *p = reinterpret_cast<const char *>(data);
+  while (len > 0) {
+    const ssize_t n = write(fd, p, len);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool readAll(int fd, void *data, size_t len) {
+  char *p = reinterpret_cast<char *>(data);
+  while (len > 0) {
+    const ssize_t n = read(fd, p, len);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+int writeFileTo(const char *dir, const char *name, const void *data, size_t len) {
+  char path[256];
+  snapshotPath(path, sizeof(path), dir, name);
+  const int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  const bool ok = writeAll(fd, data, len);
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+int readFileFrom(const char *dir, const char *name, void *data, size_t len) {
+  char path[256];
+  snapshotPath(path, sizeof(path), dir, name);
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  const bool ok = readAll(fd, data, len);
+  close(fd);
+  return ok ? 0 : -1;
+}
+}  // namespace
+
+int MeshableArena::snapshotToDir(const char *dir) {
+  if (!kMeshingEnabled || dir == nullptr) {
+    return -1;
+  }
+
+  if (unlikely(!_hugetlbSpans.empty())) {
+    // hugetlb chunks live outside the span file; snapshots don't
+    // cover them
+    debug("mesh: snapshot unsupported with MESH_HUGETLB\n");
+    return -1;
+  }
+
+  mkdir(dir, 0755);  // best effort; writes below catch real failures
+
+  SnapshotManifest manifest = {};
+  manifest.magic = SnapshotManifest::kMagic;
+  manifest.version = SnapshotManifest::kVersion;
+  manifest.arenaBegin = reinterpret_cast<uint64_t>(_arenaBegin);
+  manifest.arenaSize = _arenaSize;
+  manifest.endPage = _end;
+  manifest.mhArenaOffset = _mhAllocator.arenaOffset();
+
+  if (writeFileTo(dir, "manifest", &manifest, sizeof(manifest)) != 0) {
+    return -1;
+  }
+  if (writeFileTo(dir, "index", _mhIndex, _end * sizeof(Offset)) != 0) {
+    return -1;
+  }
+  if (writeFileTo(dir, "miniheaps", _mhAllocator.arenaBegin(), _mhAllocator.arenaOffset() * 64) != 0) {
+    return -1;
+  }
+  const size_t bitmapBytes = bitmap::representationSize(_end);
+  if (writeFileTo(dir, "meshed", _meshedBitmap.bits(), bitmapBytes) != 0) {
+    return -1;
+  }
+  if (writeFileTo(dir, "huge", _hugeBitmap.bits(), bitmapBytes) != 0) {
+    return -1;
+  }
+
+  // sparse copy of the span file: only allocated extents, so holes
+  // from freePhys stay holes
+  char path[256];
+  snapshotPath(path, sizeof(path), dir, "span");
+  const int spanFd = open(path, O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+  if (spanFd < 0) {
+    return -1;
+  }
+  if (ftruncate(spanFd, _arenaSize) != 0) {
+    close(spanFd);
+    return -1;
+  }
+
+  const auto bitmap = allocatedBitmap();
+  Span run(0, 0);
+  for (auto const &i : bitmap) {
+    if (i == run.offset + run.length) {
+      run.length++;
+      continue;
+    }
+    if (!run.empty()) {
+      copyFileExtent(spanFd, _fd, static_cast<off_t>(run.offset) * kPageSize, run.byteLength());
+    }
+    run = Span(i, 1);
+  }
+  if (!run.empty()) {
+    copyFileExtent(spanFd, _fd, static_cast<off_t>(run.offset) * kPageSize, run.byteLength());
+  }
+
+  close(spanFd);
+  return 0;
+}
+
+bool MeshableArena::tryRestoreSnapshot(const char *dir) {
+  SnapshotManifest manifest = {};
+  if (readFileFrom(dir, "manifest", &manifest, sizeof(manifest)) != 0) {
+    return false;
+  }
+  if (manifest.magic != SnapshotManifest::kMagic || manifest.version != SnapshotManifest::kVersion ||
+      manifest.arenaSize != _arenaSize) {
+    debug("mesh: snapshot in %s doesn't match this configuration, starting fresh\n", dir);
+    return false;
+  }
+
+  char path[256];
+  snapshotPath(path, sizeof(path), dir, "span");
+  const int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // the heap is full of internal pointers; it only makes sense at the
+  // address it was snapshotted from
+  void *want = reinterpret_cast<void *>(manifest.arenaBegin);
+  void *addr = mmap(want, _arenaSize, HL_MMAP_PROTECTION_MASK, kMapShared, fd, 0);
+  if (addr != want) {
+    if (addr != MAP_FAILED) {
+      munmap(addr, _arenaSize);
+    }
+    close(fd);
+    debug("mesh: snapshot address %p unavailable, starting fresh\n", want);
+    return false;
+  }
+
+  _fd = fd;
+  _arenaBegin = addr;
+  _end = manifest.endPage;
+
+  _mhIndex = reinterpret_cast<atomic<MiniHeapID> *>(SuperHeap::malloc(indexSize()));
+  hard_assert(_mhIndex != nullptr);
+  if (readFileFrom(dir, "index", _mhIndex, _end * sizeof(Offset)) != 0) {
+    abort();
+  }
+  if (readFileFrom(dir, "miniheaps", _mhAllocator.arenaBegin(), manifest.mhArenaOffset * 64) != 0) {
+    abort();
+  }
+  _mhAllocator.setArenaOffset(manifest.mhArenaOffset);
+
+  const size_t bitmapBytes = bitmap::representationSize(_end);
+  if (readFileFrom(dir, "meshed", _meshedBitmap.mut_bits(), bitmapBytes) != 0) {
+    abort();
+  }
+  if (readFileFrom(dir, "huge", _hugeBitmap.mut_bits(), bitmapBytes) != 0) {
+    abort();
+  }
+
+  // re-establish the meshed (non-identity) mappings.  Every meshed
+  // page's index entry names its ultimate keeper (finalizeMesh points
+  // all of a chain's pages at the base miniheap), so contiguous
+  // same-keeper runs chop into whole spans, each remapped to the
+  // keeper's file offset.
+  {
+    Offset runStart = 0;
+    size_t runLen = 0;
+    MiniHeapID runId{};
+
+    auto flushRun = [&]() {
+      if (runLen == 0) {
+        return;
+      }
+      auto mh = reinterpret_cast<MiniHeap *>(_mhAllocator.ptrFromOffset(runId.value()));
+      const size_t spanLen = mh->span().length;
+      const off_t keepOff = static_cast<off_t>(mh->span().offset);
+      hard_assert(spanLen > 0 && runLen % spanLen == 0);
+      for (size_t c = 0; c < runLen; c += spanLen) {
+        void *remapAddr = ptrFromOffset(runStart + c);
+        void *ptr = mmap(remapAddr, spanLen * kPageSize, HL_MMAP_PROTECTION_MASK, kMapShared | MAP_FIXED, _fd,
+                         keepOff * kPageSize);
+        hard_assert_msg(ptr != MAP_FAILED, "snapshot mesh remap failed: %d", errno);
+      }
+      runLen = 0;
+    };
+
+    for (auto const &i : _meshedBitmap) {
+      const MiniHeapID id = _mhIndex[i].load(std::memory_order_acquire);
+      if (runLen > 0 && i == runStart + runLen && id == runId) {
+        runLen++;
+        continue;
+      }
+      flushRun();
+      runStart = i;
+      runLen = 1;
+      runId = id;
+    }
+    flushRun();
+  }
+
+  _meshedPageCount = _meshedBitmap.inUseCount();
+  _restorePending = true;
+  return true;
+}
+
+void MeshableArena::completeRestoreWalk(const function<void(MiniHeap *)> &visitor) {
+  MiniHeapID lastId{};
+  Span freeRun(0, 0);
+
+  auto flushFreeRun = [&]() {
+    if (!freeRun.empty()) {
+      // dirty, not clean: the pages may hold stale snapshot data
+      freeSpan(freeRun, internal::PageType::Dirty);
+      freeRun = Span(0, 0);
+    }
+  };
+
+  for (Offset i = 0; i < _end; i++) {
+    const MiniHeapID id = _mhIndex[i].load(std::memory_order_acquire);
+
+    if (!id.hasValue()) {
+      // unindexed, unmeshed pages were free at snapshot time
+      if (!_meshedBitmap.isSet(i)) {
+        if (!freeRun.empty() && i == freeRun.offset + freeRun.length &&
+            _hugeBitmap.isSet(freeRun.offset) == _hugeBitmap.isSet(i)) {
+          freeRun.length++;
+        } else {
+          flushFreeRun();
+          freeRun = Span(i, 1);
+        }
+      }
+      lastId = MiniHeapID{};
+      continue;
+    }
+
+    if (id == lastId) {
+      continue;
+    }
+    lastId = id;
+
+    auto mh = reinterpret_cast<MiniHeap *>(_mhAllocator.ptrFromOffset(id.value()));
+    if (mh->span().offset != i) {
+      // a meshed-away page pointing at its keeper mid-span; the
+      // keeper is visited when we cross its own span start
+      continue;
+    }
+
+    visitor(mh);
+  }
+
+  flushFreeRun();
+}
+
 void MeshableArena::doAfterForkChild() {
   afterForkChild();
 }
@@ -693,29 +1496,77 @@ void MeshableArena::afterForkChild() {
 
   close(_forkPipe[0]);
 
+  // a userfaultfd monitors the parent's address space, not ours;
+  // drop it and let the first post-fork mesh re-initialize
+  if (_uffd >= 0) {
+    close(_uffd);
+    _uffd = -1;
+  }
+  _uffdInitAttempted = false;
+
+  // likewise, the pidfd refers to the parent; re-probe on next use
+  if (_pidFd >= 0) {
+    close(_pidFd);
+  }
+  _pidFd = -2;
+
+  // per-CPU heaps may have been mid-update in threads that died with
+  // the fork; start the child over with fresh ones.  Likewise drop
+  // any recycle-pool locks held by dead threads.
+  ThreadLocalHeap::ResetCpuHeapsAfterFork();
+  ThreadLocalHeap::ResetRecyclePoolAfterFork();
+  runtime().heap().resetLargeSpanCacheLocksAfterFork();
+
   char *oldSpanDir = _spanDir;
 
   // open new file for the arena
-  int newFd = openSpanFile(kArenaSize);
+  int newFd = openSpanFile(_arenaSize);
 
   struct stat fileinfo;
   memset(&fileinfo, 0, sizeof(fileinfo));
   fstat(newFd, &fileinfo);
-  d_assert(fileinfo.st_size >= 0 && (size_t)fileinfo.st_size == kArenaSize);
+  d_assert(fileinfo.st_size >= 0 && (size_t)fileinfo.st_size == _arenaSize);
 
   const int oldFd = _fd;
 
   const auto bitmap = allocatedBitmap();
-  for (auto const &i : bitmap) {
-    int result = internal::copyFile(newFd, oldFd, i * kPageSize, kPageSize);
-    d_assert(result == CPUInfo::PageSize);
+
+  bool cloned = false;
+#ifdef FICLONE
+  // O(1) on reflink-capable filesystems (btrfs, XFS): the child's
+  // file shares all extents with the parent's and pages are
+  // copied-on-write by the filesystem.  memfd/tmpfs rejects this and
+  // we fall through to extent copies.
+  if (ioctl(newFd, FICLONE, oldFd) == 0) {
+    cloned = true;
   }
+#endif
 
-  int r = mprotect(_arenaBegin, kArenaSize, PROT_READ | PROT_WRITE);
+  if (!cloned) {
+    // copy contiguous allocated extents rather than one page at a
+    // time; this both amortizes the syscall and skips the holes we've
+    // punched in the span file
+    Span run(0, 0);
+    for (auto const &i : bitmap) {
+      if (i == run.offset + run.length) {
+        run.length++;
+        continue;
+      }
+      if (!run.empty()) {
+        copyFileExtent(newFd, oldFd, static_cast<off_t>(run.offset) * kPageSize, run.byteLength());
+      }
+      run = Span(i, 1);
+    }
+    if (!run.empty()) {
+      copyFileExtent(newFd, oldFd, static_cast<off_t>(run.offset) * kPageSize, run.byteLength());
+    }
+  }
+
+  int r = mprotect(_arenaBegin, _arenaSize, PROT_READ | PROT_WRITE);
   hard_assert(r == 0);
 
   // remap the new region over the old
-  void *ptr = mmap(_arenaBegin, kArenaSize, HL_MMAP_PROTECTION_MASK, kMapShared | MAP_FIXED, newFd, 0);
+  void *ptr = mmap(_arenaBegin, _arenaSize, HL_MMAP_PROTECTION_MASK, kMapShared | MAP_FIXED, newFd, 0);
   hard_assert_msg(ptr != MAP_FAILED, "map failed: %d", errno);
 
   // re-do the meshed mappings
@@ -760,6 +1611,19 @@ void MeshableArena::afterForkChild() {
     }
   }
 
+  // hugetlb chunks are not part of the span file; re-overlay them
+  // from the (still shared) hugetlb memfd.  Opting into MESH_HUGETLB
+  // in a forking process means these large-allocation pages remain
+  // shared with the parent.
+  if (!_hugetlbSpans.empty()) {
+    debug("mesh: warning: hugetlb-backed spans remain shared across fork\n");
+    for (auto const &entry : _hugetlbSpans) {
+      const Span &span = entry.first;
+      mmap(ptrFromOffset(span.offset), span.byteLength(), HL_MMAP_PROTECTION_MASK, MAP_SHARED | MAP_FIXED, _hugetlbFd,
+           entry.second);
+    }
+  }
+
   _fd = newFd;
 
   internal::Heap().free(oldSpanDir);
@@ -17,6 +17,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
@@ -44,8 +45,132 @@
 #define MADV_DODUMP 0
 #endif
 
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 0
+#endif
+
+#ifndef MADV_MERGEABLE
+#define MADV_MERGEABLE 0
+#endif
+
 namespace mesh {
 
+// An offset-sorted set of free spans that merges physically adjacent
+// spans as they are inserted and serves allocations best-fit in
+// O(log n).  This replaces the old per-span-class vectors, whose
+// first-fit scans degraded as long-running heaps fragmented into many
+// small spans.
+class SpanSet {
+public:
+  // insert a span, merging it with free neighbors on either side
+  void insert(Span span) {
+    d_assert(!span.empty());
+
+    auto prev = internal::greatest_leq(_byOffset, span.offset);
+    if (prev != _byOffset.end() && prev->first + prev->second == span.offset) {
+      span = Span(prev->first, prev->second + span.length);
+      _bySize.erase(std::make_pair(prev->second, prev->first));
+      _byOffset.erase(prev);
+    }
+
+    auto next = _byOffset.find(span.offset + span.length);
+    if (next != _byOffset.end()) {
+      span.length += next->second;
+      _bySize.erase(std::make_pair(next->second, next->first));
+      _byOffset.erase(next);
+    }
+
+    _byOffset[span.offset] = span.length;
+    _bySize.insert(std::make_pair(span.length, span.offset));
+  }
+
+  // take a span of exactly pageCount pages (best fit; any remainder
+  // stays free).  Returns false if no span is large enough.
+  bool take(Length pageCount, Span &result) {
+    auto it = _bySize.lower_bound(std::make_pair(pageCount, 0));
+    if (it == _bySize.end()) {
+      return false;
+    }
+
+    Span found(it->second, it->first);
+    _bySize.erase(it);
+    _byOffset.erase(found.offset);
+
+    Span rest = found.splitAfter(pageCount);
+    if (!rest.empty()) {
+      // nothing adjacent to merge with -- we just removed its only
+      // potential neighbor
+      _byOffset[rest.offset] = rest.length;
+      _bySize.insert(std::make_pair(rest.length, rest.offset));
+    }
+
+    result = found;
+    return true;
+  }
+
+  // take the largest free span (used by the batched scavenger);
+  // returns false when empty
+  bool takeLargest(Span &result) {
+    if (_bySize.empty()) {
+      return false;
+    }
+
+    auto it = --_bySize.end();
+    result = Span(it->second, it->first);
+    _bySize.erase(it);
+    _byOffset.erase(result.offset);
+    return true;
+  }
+
+  // claim exactly [offset, offset+length) if that whole range is
+  // free, e.g. to grow an allocation in place
+  bool claimRange(Offset offset, Length length) {
+    auto it = internal::greatest_leq(_byOffset, offset);
+    if (it == _byOffset.end() || it->first + it->second < offset + length) {
+      return false;
+    }
+
+    const Span found(it->first, it->second);
+    _bySize.erase(std::make_pair(found.length, found.offset));
+    _byOffset.erase(it);
+
+    if (found.offset < offset) {
+      const Span left(found.offset, offset - found.offset);
+      _byOffset[left.offset] = left.length;
+      _bySize.insert(std::make_pair(left.length, left.offset));
+    }
+    if (offset + length < found.offset + found.length) {
+      const Span right(offset + length, found.offset + found.length - (offset + length));
+      _byOffset[right.offset] = right.length;
+      _bySize.insert(std::make_pair(right.length, right.offset));
+    }
+
+    return true;
+  }
+
+  template <typename Func>
+  void forEach(const Func &func) const {
+    for (auto const &entry : _byOffset) {
+      func(Span(entry.first, entry.second));
+    }
+  }
+
+  bool empty() const {
+    return _byOffset.empty();
+  }
+
+  void clear() {
+    _byOffset.clear();
+    _bySize.clear();
+  }
+
+private:
+  internal::map<Offset, Length> _byOffset;
+  // (length, offset) pairs; lower_bound gives the best (smallest
+  // sufficient) span for a request
+  internal::set<std::pair<Length, Offset>> _bySize;
+};
+
 class MeshableArena : public mesh::OneWayMmapHeap {
 private:
   DISALLOW_COPY_AND_ASSIGN(MeshableArena);
@@ -59,10 +184,27 @@ public:
   inline bool contains(const void *ptr) const {
     auto arena = reinterpret_cast<uintptr_t>(_arenaBegin);
     auto ptrval = reinterpret_cast<uintptr_t>(ptr);
-    return arena <= ptrval && ptrval < arena + kArenaSize;
+    return arena <= ptrval && ptrval < arena + _arenaSize;
+  }
+
+  // the configured reservation for this process; kArenaSize is only
+  // the compile-time ceiling the metadata is sized for
+  inline size_t arenaSize() const {
+    return _arenaSize;
   }
 
-  char *pageAlloc(Span &result, size_t pageCount, size_t pageAlignment = 1);
+  // hugeEligible routes the span to the THP-backed tier; only spans
+  // that will never participate in meshing may set it.  When zeroed
+  // is non-null it is set iff the returned pages are known to read as
+  // zero (clean spans: freshly expanded, or hole-punched + madvised),
+  // letting calloc skip its memset.
+  char *pageAlloc(Span &result, size_t pageCount, size_t pageAlignment = 1, bool hugeEligible = false,
+                  bool *zeroed = nullptr);
+
+  // claim extraPages of free pages physically adjacent to span's end,
+  // so a page-backed allocation can grow without moving.  Returns
+  // false if the adjacent pages are not free.
+  bool tryExtendSpan(const Span &span, Length extraPages);
 
   void free(void *ptr, size_t sz, internal::PageType type);
 
@@ -84,7 +226,12 @@ public:
   inline void *ATTRIBUTE_ALWAYS_INLINE miniheapForArenaOffset(Offset arenaOff) const {
     const MiniHeapID mhOff = _mhIndex[arenaOff].load(std::memory_order_acquire);
     if (likely(mhOff.hasValue())) {
-      return _mhAllocator.ptrFromOffset(mhOff.value());
+      void *mh = _mhAllocator.ptrFromOffset(mhOff.value());
+      // a MiniHeap is exactly one cacheline and the caller will read
+      // its flags/bitmap within a few instructions; start the (cold)
+      // load now, overlapped with the return
+      __builtin_prefetch(mh, 1, 3);
+      return mh;
     }
 
     return nullptr;
@@ -105,7 +252,24 @@ public:
   void finalizeMesh(void *keep, void *remove, size_t sz);
 
   inline bool aboveMeshThreshold() const {
-    return _meshedPageCount > _maxMeshCount;
+    if (_meshedPageCount > _maxMeshCount) {
+      return true;
+    }
+
+    // live VMA budget: other libraries create mappings too, so the
+    // static mesh cap alone can still walk the process into
+    // max_map_count.  Compare the last measured map count, plus a
+    // worst-case estimate for meshes since then (each remap can split
+    // one VMA into three), against 90% of the kernel limit.
+    if (_mapBudget > 0 && _processMapCount > 0) {
+      const size_t sinceMeasure = _meshVmasSinceMeasure > 0 ? static_cast<size_t>(_meshVmasSinceMeasure) : 0;
+      const size_t estimated = _processMapCount + 2 * sinceMeasure;
+      if (estimated * 10 > _mapBudget * 9) {
+        return true;
+      }
+    }
+
+    return false;
   }
 
   inline void setMaxMeshCount(size_t maxMeshCount) {
@@ -113,6 +277,15 @@ public:
     _maxMeshCount = maxMeshCount;
   }
 
+  inline void setMapBudget(size_t mapBudget) {
+    _mapBudget = mapBudget;
+  }
+
+  // re-measure the process's actual VMA count from /proc/self/maps;
+  // called periodically (not per-mesh -- it reads proc) so the budget
+  // tracks mappings created outside the allocator too
+  void updateVmaBudget();
+
   inline size_t maxMeshCount() const {
     return _maxMeshCount;
   }
@@ -122,6 +295,31 @@ public:
   void scavenge(bool force);
   // like a scavenge, but we only MADV_FREE
   void partialScavenge();
+  // release at most maxPages of dirty pages back to the OS, returning
+  // the number of pages released.  Used by the background scavenger
+  // to spread page release out over time.
+  size_t scavengeBatch(size_t maxPages);
+
+  inline size_t dirtyPageCount() const {
+    return _dirtyPageCount;
+  }
+
+  // cheap, lock-free estimate of our committed pages: clean spans
+  // counted when handed out (they fault in as they're touched),
+  // decremented when physical backing is released via freePhys.  An
+  // over-approximation for never-touched tails; recalibrated from
+  // smaps periodically by the background thread.
+  inline size_t committedPageEstimate() const {
+    return _committedPageEstimate.load(std::memory_order_relaxed);
+  }
+
+  inline size_t rssKbEstimate() const {
+    return committedPageEstimate() * (kPageSize / 1024);
+  }
+
+  // reset the estimate from the kernel's numbers; costs a
+  // /proc/self/smaps_rollup parse, so callers should rate-limit
+  void calibrateCommittedEstimate();
 
   // return the maximum number of pages we've had meshed (and thus our
   // savings) at any point in time.
@@ -129,6 +327,10 @@ public:
     return _meshedPageCountHWM;
   }
 
+  inline size_t meshedPageCount() const {
+    return _meshedPageCount;
+  }
+
   inline size_t RSSAtHighWaterMark() const {
     return _rssKbAtHWM;
   }
@@ -136,19 +338,49 @@ public:
   char *arenaBegin() const {
     return reinterpret_cast<char *>(_arenaBegin);
   }
+  // the page extent the arena has grown to
+  Offset arenaEndPage() const {
+    return _end;
+  }
   void *arenaEnd() const {
-    return reinterpret_cast<char *>(_arenaBegin) + kArenaSize;
+    return reinterpret_cast<char *>(_arenaBegin) + _arenaSize;
   }
 
   void doAfterForkChild();
 
   void freePhys(void *ptr, size_t sz);
+
+  // --- heap snapshot / warm restart ---------------------------------
+  //
+  // The arena is already file-backed; a snapshot persists the rest:
+  // a manifest (mapping address, extent, metadata bump offset), the
+  // page->miniheap index, the miniheap metadata slab (all of whose
+  // links are offset-based, so it is position-independent), the
+  // meshed/huge page bitmaps, and a sparse copy of the span file.
+  // Restore happens in two phases: the constructor maps everything
+  // back at the recorded address, and completeSnapshotRestore()
+  // (called once the runtime exists) rebuilds the freelist state.
+
+  // write a snapshot into dir; must be called with the global heap
+  // quiesced (GlobalHeap::lock held).  Returns 0 on success.
+  int snapshotToDir(const char *dir);
+
+  inline bool restorePending() const {
+    return _restorePending;
+  }
+
+  // phase two of restore: rebuild the free-span sets from unindexed
+  // pages and invoke visitor once per live miniheap (at its span
+  // start) so the global heap can rebuild its freelists
+  void completeRestoreWalk(const function<void(MiniHeap *)> &visitor);
+
+  inline void clearRestorePending() {
+    _restorePending = false;
+  }
 private:
-  void expandArena(size_t minPagesAdded);
-  bool findPages(size_t pageCount, Span &result, internal::PageType &type);
-  bool ATTRIBUTE_NEVER_INLINE findPagesInner(internal::vector<Span> freeSpans[kSpanClassCount], size_t i,
-                                             size_t pageCount, Span &result);
-  Span reservePages(size_t pageCount, size_t pageAlignment);
+  void expandArena(size_t minPagesAdded, bool huge = false);
+  bool findPages(size_t pageCount, Span &result, internal::PageType &type, bool huge);
+  Span reservePages(size_t pageCount, size_t pageAlignment, bool huge, internal::PageType &type);
   internal::RelaxedBitmap allocatedBitmap(bool includeDirty = true) const;
 
   void *malloc(size_t sz) = delete;
@@ -169,15 +401,23 @@ private:
     }
   }
 
+  // whether the span was carved from the THP-backed tier.  Tier
+  // membership is per 2MB chunk, so checking the first page suffices.
+  inline bool isHugeSpan(const Span &span) const {
+    return _hugeBitmap.isSet(span.offset);
+  }
+
   inline void freeSpan(const Span &span, const internal::PageType flags) {
     if (span.length == 0) {
       return;
     }
 
+    const bool huge = isHugeSpan(span);
+
     // this happens when we are trying to get an aligned allocation
     // and returning excess back to the arena
     if (flags == internal::PageType::Clean) {
-      _clean[span.spanClass()].push_back(span);
+      (huge ? _cleanHuge : _clean).insert(span);
       return;
     }
 
@@ -188,7 +428,7 @@ private:
         madvise(ptrFromOffset(span.offset), span.length * kPageSize, MADV_DONTDUMP);
       }
       d_assert(span.length > 0);
-      _dirty[span.spanClass()].push_back(span);
+      (huge ? _dirtyHuge : _dirty).insert(span);
       _dirtyPageCount += span.length;
 
       if (_dirtyPageCount > kMaxDirtyPageThreshold) {
@@ -209,6 +449,36 @@ private:
   int openSpanFile(size_t sz);
   char *openSpanDir(int pid);
 
+  // reservation size for this process: MESH_ARENA_SIZE_GB clamped to
+  // [1GB, kArenaSize], defaulting to kDefaultArenaSize
+  static size_t determineArenaSize();
+
+  // bind a fresh expansion chunk to the requesting thread's NUMA node
+  // (MPOL_PREFERRED); no-op unless MESH_NUMA=1
+  void bindExpansionToLocalNode(const Span &span);
+
+  // overlay a huge-tier expansion chunk from the hugetlb memfd;
+  // returns false (falling back to the THP madvise) when hugetlb
+  // pages aren't available
+  bool tryBackWithHugetlb(const Span &span);
+  // the hugetlb file offset for ptr, or -1 if ptr isn't hugetlb-backed
+  off_t hugetlbOffsetFor(const void *ptr, size_t sz) const;
+
+  // constructor-time restore: map the snapshot's span file and
+  // metadata back at the recorded address.  Returns false (leaving
+  // members untouched for the normal fresh path) on any mismatch.
+  bool tryRestoreSnapshot(const char *dir);
+
+  // set up a userfaultfd for write-protecting spans during meshing;
+  // returns false (leaving us on the mprotect/SIGSEGV path) when the
+  // kernel doesn't support it.
+  bool tryInitUffd();
+
+  // MADV_DONTNEED every range in iov -- one process_madvise(2)
+  // syscall per batch where the kernel supports it, otherwise one
+  // madvise per range.
+  void madviseDontNeed(const struct iovec *iov, size_t count);
+
   // pointer must already have been checked by `contains()` for bounds
   inline Offset offsetFor(const void *ptr) const {
     const uintptr_t ptrval = reinterpret_cast<uintptr_t>(ptr);
@@ -265,6 +535,8 @@ private:
     auto ptr = ptrFromOffset(span.offset);
     auto sz = span.byteLength();
     mmap(ptr, sz, HL_MMAP_PROTECTION_MASK, kMapShared | MAP_FIXED, _fd, span.offset * kPageSize);
+    // restoring identity merges this span back into its neighbors
+    _meshVmasSinceMeasure--;
   }
 
   void prepareForFork();
@@ -272,6 +544,7 @@ private:
   void afterForkChild();
 
   void *_arenaBegin{nullptr};
+  const size_t _arenaSize;
   // indexed by page offset.
   atomic<MiniHeapID> *_mhIndex{nullptr};
 
@@ -286,20 +559,63 @@ private:
   // to identity mappings in the page tables.
   internal::vector<Span> _toReset;
 
-  internal::vector<Span> _clean[kSpanClassCount];
-  internal::vector<Span> _dirty[kSpanClassCount];
+  SpanSet _clean;
+  SpanSet _dirty;
+
+  // free spans in the THP-backed tier; kept apart from the 4KB tier
+  // so huge-backed memory is never handed to meshable miniheaps
+  SpanSet _cleanHuge;
+  SpanSet _dirtyHuge;
 
   size_t _dirtyPageCount{0};
 
   internal::RelaxedBitmap _meshedBitmap{
       kArenaSize / kPageSize,
       reinterpret_cast<char *>(OneWayMmapHeap().malloc(bitmap::representationSize(kArenaSize / kPageSize))), false};
+  // pages belonging to 2MB THP-tier chunks
+  internal::RelaxedBitmap _hugeBitmap{
+      kArenaSize / kPageSize,
+      reinterpret_cast<char *>(OneWayMmapHeap().malloc(bitmap::representationSize(kArenaSize / kPageSize))), false};
   size_t _meshedPageCount{0};
   size_t _meshedPageCountHWM{0};
   size_t _rssKbAtHWM{0};
   size_t _maxMeshCount{kDefaultMaxMeshCount};
 
+  // kernel max_map_count (0 = unknown), last measured process VMA
+  // count, and the net mappings meshing has added since that measure
+  size_t _mapBudget{0};
+  size_t _processMapCount{0};
+  ssize_t _meshVmasSinceMeasure{0};
+
+  atomic_size_t _committedPageEstimate{0};
+
+  // set when the constructor mapped a snapshot back in; cleared once
+  // GlobalHeap::completeSnapshotRestore has rebuilt the freelists
+  bool _restorePending{false};
+
+  // MESH_NUMA=1: prefer node-local placement for expansion chunks
+  bool _numaAware{false};
+  // MESH_MERGEABLE=1: offer the (anonymous) arena to KSM for
+  // cross-process dedupe; only honored when meshing is disabled
+  bool _mergeableRequested{false};
+
   int _fd;
+  // userfaultfd used to write-protect spans during meshing; -1 when
+  // unsupported (we fall back to mprotect + the SIGSEGV handler)
+  int _uffd{-1};
+  bool _uffdInitAttempted{false};
+  // pidfd for batched process_madvise(2); -2 means not yet probed,
+  // -1 means unsupported (per-span madvise fallback)
+  int _pidFd{-2};
+
+  // opt-in hugetlb backing for the never-meshed tier (MESH_HUGETLB=1):
+  // expansion chunks are overlaid from a MFD_HUGETLB memfd.  Each
+  // entry records the chunk and its offset in that file, for hole
+  // punching and post-fork re-overlay.
+  bool _hugetlbRequested{false};
+  int _hugetlbFd{-1};
+  off_t _hugetlbEnd{0};
+  internal::vector<std::pair<Span, off_t>> _hugetlbSpans;
   int _forkPipe[2]{-1, -1};  // used for signaling during fork
   char *_spanDir{nullptr};
 };
@@ -11,6 +11,13 @@
 #include <atomic>
 #include <limits>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "bitmap.h"
 #include "common.h"
 #include "internal.h"
@@ -20,6 +27,76 @@ namespace mesh {
 
 using internal::Bitmap;
 
+// the batched meshability test below reports results as set bits in a
+// uint64_t, so it can check at most 64 candidates per call.
+static constexpr size_t kMaxMeshableBatchSize = 64;
+
+inline bool ATTRIBUTE_ALWAYS_INLINE bitmapsMeshableScalar(const uint64_t *__restrict__ bitmapL,
+                                                          const uint64_t *__restrict__ bitmapR,
+                                                          size_t byteLen) noexcept {
+  uint64_t result = 0;
+
+  for (size_t i = 0; i < byteLen / sizeof(uint64_t); i++) {
+    result |= bitmapL[i] & bitmapR[i];
+  }
+
+  return result == 0;
+}
+
+#if defined(__x86_64__)
+// runtime dispatch level for the meshability kernels.  We only
+// distinguish AVX2 from scalar: our per-miniheap bitmaps are 32 bytes
+// (256 bits), so a single AVX2 register covers a whole bitmap and
+// wider vectors only pay off in the batched kernel below.
+enum SimdLevel : uint8_t {
+  SimdScalar = 0,
+  SimdAVX2 = 1,
+  SimdAVX512 = 2,
+};
+
+inline SimdLevel ATTRIBUTE_ALWAYS_INLINE simdLevel() noexcept {
+  static const SimdLevel level = []() {
+    if (__builtin_cpu_supports("avx512f")) {
+      return SimdAVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdAVX2;
+    }
+    return SimdScalar;
+  }();
+  return level;
+}
+
+__attribute__((target("avx2"))) inline bool bitmapsMeshableAVX2(const uint64_t *__restrict__ bitmapL,
+                                                                const uint64_t *__restrict__ bitmapR,
+                                                                size_t byteLen) noexcept {
+  for (size_t i = 0; i < byteLen; i += 32) {
+    const __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bitmapL + i / sizeof(uint64_t)));
+    const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bitmapR + i / sizeof(uint64_t)));
+    if (!_mm256_testz_si256(l, r)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+inline bool bitmapsMeshableNEON(const uint64_t *__restrict__ bitmapL, const uint64_t *__restrict__ bitmapR,
+                                size_t byteLen) noexcept {
+  uint64x2_t acc = vdupq_n_u64(0);
+
+  for (size_t i = 0; i < byteLen / sizeof(uint64_t); i += 2) {
+    const uint64x2_t l = vld1q_u64(bitmapL + i);
+    const uint64x2_t r = vld1q_u64(bitmapR + i);
+    acc = vorrq_u64(acc, vandq_u64(l, r));
+  }
+
+  return (vgetq_lane_u64(acc, 0) | vgetq_lane_u64(acc, 1)) == 0;
+}
+#endif
+
 inline bool bitmapsMeshable(const Bitmap::word_t *__restrict__ bitmap1, const Bitmap::word_t *__restrict__ bitmap2,
                             size_t byteLen) noexcept {
   d_assert(reinterpret_cast<uintptr_t>(bitmap1) % 16 == 0);
@@ -37,23 +114,151 @@ inline bool bitmapsMeshable(const Bitmap::word_t *__restrict__ bitmap1, const Bi
   const auto bitmapL = (const uint64_t *)__builtin_assume_aligned(bitmap1, 16);
   const auto bitmapR = (const uint64_t *)__builtin_assume_aligned(bitmap2, 16);
 
-  uint64_t result = 0;
+#if defined(__x86_64__)
+  if (likely(simdLevel() >= SimdAVX2 && byteLen % 32 == 0)) {
+    return bitmapsMeshableAVX2(bitmapL, bitmapR, byteLen);
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  if (likely(byteLen % 16 == 0)) {
+    return bitmapsMeshableNEON(bitmapL, bitmapR, byteLen);
+  }
+#endif
 
-  for (size_t i = 0; i < byteLen / sizeof(size_t); i++) {
-    result |= bitmapL[i] & bitmapR[i];
+  return bitmapsMeshableScalar(bitmapL, bitmapR, byteLen);
+}
+
+inline uint64_t bitmapsMeshableBatchScalar(const uint64_t *__restrict__ bitmapL,
+                                           const uint64_t *const *__restrict__ bitmapsR, size_t count,
+                                           size_t byteLen) noexcept {
+  uint64_t meshable = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (bitmapsMeshableScalar(bitmapL, bitmapsR[i], byteLen)) {
+      meshable |= 1ULL << i;
+    }
   }
 
-  return result == 0;
+  return meshable;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) inline uint64_t bitmapsMeshableBatchAVX2(const uint64_t *__restrict__ bitmapL,
+                                                                         const uint64_t *const *__restrict__ bitmapsR,
+                                                                         size_t count) noexcept {
+  // load the left bitmap once; the whole point of the batched kernel
+  // is to avoid re-reading it for every right-side candidate.
+  const __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bitmapL));
+
+  uint64_t meshable = 0;
+  for (size_t i = 0; i < count; i++) {
+    const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bitmapsR[i]));
+    if (_mm256_testz_si256(l, r)) {
+      meshable |= 1ULL << i;
+    }
+  }
+
+  return meshable;
+}
+
+__attribute__((target("avx512f"))) inline uint64_t bitmapsMeshableBatchAVX512(
+    const uint64_t *__restrict__ bitmapL, const uint64_t *const *__restrict__ bitmapsR, size_t count) noexcept {
+  // with 32-byte bitmaps a 512-bit register holds two right-side
+  // candidates, so test them pairwise against a broadcast left bitmap.
+  const __m512i l2 = _mm512_broadcast_i64x4(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(bitmapL)));
+
+  uint64_t meshable = 0;
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    const __m512i r2 = _mm512_inserti64x4(
+        _mm512_castsi256_si512(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(bitmapsR[i]))),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bitmapsR[i + 1])), 1);
+    const __mmask8 overlap = _mm512_test_epi64_mask(l2, r2);
+    if ((overlap & 0x0f) == 0) {
+      meshable |= 1ULL << i;
+    }
+    if ((overlap & 0xf0) == 0) {
+      meshable |= 1ULL << (i + 1);
+    }
+  }
+  if (i < count) {
+    if (bitmapsMeshableScalar(bitmapL, bitmapsR[i], 32)) {
+      meshable |= 1ULL << i;
+    }
+  }
+
+  return meshable;
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+inline uint64_t bitmapsMeshableBatchNEON(const uint64_t *__restrict__ bitmapL,
+                                         const uint64_t *const *__restrict__ bitmapsR, size_t count) noexcept {
+  const uint64x2_t l0 = vld1q_u64(bitmapL);
+  const uint64x2_t l1 = vld1q_u64(bitmapL + 2);
+
+  uint64_t meshable = 0;
+  for (size_t i = 0; i < count; i++) {
+    const uint64x2_t overlap0 = vandq_u64(l0, vld1q_u64(bitmapsR[i]));
+    const uint64x2_t overlap1 = vandq_u64(l1, vld1q_u64(bitmapsR[i] + 2));
+    const uint64x2_t acc = vorrq_u64(overlap0, overlap1);
+    if ((vgetq_lane_u64(acc, 0) | vgetq_lane_u64(acc, 1)) == 0) {
+      meshable |= 1ULL << i;
+    }
+  }
+
+  return meshable;
+}
+#endif
+
+// tests one left-side bitmap against up to kMaxMeshableBatchSize
+// right-side candidates in a single pass; bit i of the result is set
+// iff bitmapL and bitmapsR[i] have no overlapping set bits.  The same
+// benign 1 -> 0 race described in bitmapsMeshable applies here.
+inline uint64_t bitmapsMeshableBatch(const Bitmap::word_t *__restrict__ bitmap1,
+                                     const Bitmap::word_t *const *__restrict__ bitmaps2, size_t count,
+                                     size_t byteLen) noexcept {
+  d_assert(count <= kMaxMeshableBatchSize);
+  d_assert(byteLen >= 8);
+  d_assert(byteLen % 8 == 0);
+
+  const auto bitmapL = (const uint64_t *)__builtin_assume_aligned(bitmap1, 16);
+  const auto bitmapsR = reinterpret_cast<const uint64_t *const *>(bitmaps2);
+
+#if defined(__x86_64__)
+  if (likely(byteLen == 32)) {
+    const auto level = simdLevel();
+    if (level >= SimdAVX512) {
+      return bitmapsMeshableBatchAVX512(bitmapL, bitmapsR, count);
+    }
+    if (level >= SimdAVX2) {
+      return bitmapsMeshableBatchAVX2(bitmapL, bitmapsR, count);
+    }
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  if (likely(byteLen == 32)) {
+    return bitmapsMeshableBatchNEON(bitmapL, bitmapsR, count);
+  }
+#endif
+
+  return bitmapsMeshableBatchScalar(bitmapL, bitmapsR, count, byteLen);
 }
 
 namespace method {
 
-// split miniheaps into two lists in a random order
-void halfSplit(MWC &prng, MiniHeapListEntry *miniheaps, SplitArray &left, size_t &leftSize, SplitArray &right,
-               size_t &rightSize) noexcept;
+// split the miniheaps on the given occupancy-band lists into two
+// lists in a random order.  The band lists already exclude miniheaps
+// at or above the occupancy cutoff, so no fullness filter is needed.
+void halfSplit(MWC &prng, MiniHeapListEntry *const *miniheapBands, size_t bandCount, SplitArray &left, size_t &leftSize,
+               SplitArray &right, size_t &rightSize) noexcept;
+
+void shiftedSplitting(MWC &prng, MiniHeapListEntry *const *miniheapBands, size_t bandCount, SplitArray &left,
+                      SplitArray &right, const function<bool(std::pair<MiniHeap *, MiniHeap *> &&)> &meshFound) noexcept;
 
-void shiftedSplitting(MWC &prng, MiniHeapListEntry *miniheaps, SplitArray &left, SplitArray &right,
-                      const function<bool(std::pair<MiniHeap *, MiniHeap *> &&)> &meshFound) noexcept;
+// start n worker threads (0 disables, the default) that partition the
+// candidate windows of the mesh scan and run the bitmap probes in
+// parallel; found pairs are still funneled to meshLocked sequentially.
+// Must be called without heap locks held (it may create threads).
+void setMeshScanWorkers(size_t n);
 }  // namespace method
 }  // namespace mesh
 
@@ -35,7 +35,9 @@ private:
   static constexpr uint32_t FreelistIdShift = 6;
   static constexpr uint32_t ShuffleVectorOffsetShift = 8;
   static constexpr uint32_t MaxCountShift = 16;
+  static constexpr uint32_t OccupancyBandShift = 25;
   static constexpr uint32_t MeshedOffset = 30;
+  static constexpr uint32_t PinnedOffset = 31;
 
   inline void ATTRIBUTE_ALWAYS_INLINE setMasked(uint32_t mask, uint32_t newVal) {
     uint32_t oldFlags = _flags.load(std::memory_order_relaxed);
@@ -91,6 +93,17 @@ public:
     setMasked(mask, newVal);
   }
 
+  inline uint32_t occupancyBand() const {
+    return (_flags.load(std::memory_order_seq_cst) >> OccupancyBandShift) & 0x3;
+  }
+
+  inline void setOccupancyBand(uint32_t band) {
+    d_assert(band < kOccupancyBands);
+    uint32_t mask = ~(static_cast<uint32_t>(0x3) << OccupancyBandShift);
+    uint32_t newVal = (band << OccupancyBandShift);
+    setMasked(mask, newVal);
+  }
+
   inline void setMeshed() {
     set(MeshedOffset);
   }
@@ -103,6 +116,18 @@ public:
     return is(MeshedOffset);
   }
 
+  inline void setPinned() {
+    set(PinnedOffset);
+  }
+
+  inline void unsetPinned() {
+    unset(PinnedOffset);
+  }
+
+  inline bool ATTRIBUTE_ALWAYS_INLINE isPinned() const {
+    return is(PinnedOffset);
+  }
+
 private:
   inline bool ATTRIBUTE_ALWAYS_INLINE is(size_t offset) const {
     const auto mask = getSingleBitMask(offset);
@@ -172,6 +197,14 @@ public:
     return _span;
   }
 
+  // grow this span in place after the arena has claimed the adjacent
+  // pages for us; only valid for single-object (large) miniheaps,
+  // whose object size is defined by the span length
+  inline void extendSpan(Length pages) {
+    d_assert(isLargeAlloc());
+    _span.length += pages;
+  }
+
   void printOccupancy() const {
     mesh::debug("{\"name\": \"%p\", \"object-size\": %d, \"length\": %d, \"mesh-count\": %d, \"bitmap\": \"%s\"}\n",
                 this, objectSize(), maxCount(), meshCount(), _bitmap.to_string(maxCount()).c_str());
@@ -314,6 +347,16 @@ public:
     _flags.setFreelistId(id);
   }
 
+  // which partial-occupancy band list this miniheap is on; only
+  // meaningful while freelistId() == list::Partial
+  inline uint32_t occupancyBand() const {
+    return _flags.occupancyBand();
+  }
+
+  inline void setOccupancyBand(uint32_t band) {
+    _flags.setOccupancyBand(band);
+  }
+
   inline pid_t current() const {
     return _current.load(std::memory_order::memory_order_acquire);
   }
@@ -336,7 +379,24 @@ public:
   }
 
   inline bool isMeshingCandidate() const {
-    return !isAttached() && objectSize() < kPageSize;
+    // anything with more than one object per span can mesh; that now
+    // includes page-multiple object strides up to kMaxSize.  Pinned
+    // miniheaps are excluded at the owner's request.
+    return !isAttached() && maxCount() > 1 && !isPinned();
+  }
+
+  // pin/unpin are idempotent at the flag level; the global heap keeps
+  // the pinned count under the lock shard
+  inline void pin() {
+    _flags.setPinned();
+  }
+
+  inline void unpin() {
+    _flags.unsetPinned();
+  }
+
+  inline bool isPinned() const {
+    return _flags.isPinned();
   }
 
   /// Returns the fraction full (in the range [0, 1]) that this miniheap is.
@@ -512,13 +572,17 @@ protected:
     return spanptr;
   }
 
+  // field order keeps the free path's reads (bitmap, span, owner,
+  // flags, reciprocal, mesh link) contiguous from the front of the
+  // line; the freelist links are only touched under the heap's lock
+  // shards, so they sit last
   internal::Bitmap _bitmap;           // 32 bytes 32
-  const Span _span;                   // 8        40
-  MiniHeapListEntry _freelist{};      // 8        48
-  atomic<pid_t> _current{0};          // 4        52
-  Flags _flags;                       // 4        56
-  const float _objectSizeReciprocal;  // 4        60
-  MiniHeapID _nextMeshed{};           // 4        64
+  Span _span;                         // 8        40
+  atomic<pid_t> _current{0};          // 4        44
+  Flags _flags;                       // 4        48
+  const float _objectSizeReciprocal;  // 4        52
+  MiniHeapID _nextMeshed{};           // 4        56
+  MiniHeapListEntry _freelist{};      // 8        64
 };
 
 typedef FixedArray<MiniHeap, 63> MiniHeapArray;
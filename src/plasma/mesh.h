@@ -20,9 +20,92 @@ extern "C" {
 // allocator-related options.
 int mesh_mallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
 
+#define MESH_INTROSPECT_VERSION 1
+#define MESH_MAX_SIZE_CLASSES 33
+#define MESH_OCCUPANCY_BANDS 4
+
+typedef struct {
+  unsigned long long object_size;
+  unsigned long long empty;    /* empty miniheaps on the freelist */
+  unsigned long long partial[MESH_OCCUPANCY_BANDS]; /* occupancy histogram */
+  unsigned long long full;
+  unsigned long long meshed_pages; /* pages reclaimed by meshing this class */
+} mesh_size_class_stats_t;
+
+typedef struct {
+  /* set to MESH_INTROSPECT_VERSION by the caller before the call; the
+   * library refuses mismatched layouts instead of scribbling */
+  unsigned int version;
+  unsigned int size_class_count;
+
+  unsigned long long mesh_count;         /* meshes performed, lifetime */
+  unsigned long long meshed_page_count;  /* pages currently meshed away */
+  unsigned long long meshed_page_hwm;
+  unsigned long long dirty_page_count;   /* pages waiting to be scavenged */
+  unsigned long long miniheap_count;
+  unsigned long long miniheap_alloc_count;
+  unsigned long long miniheap_free_count;
+
+  /* per-thread counters, aggregated at read time */
+  unsigned long long alloc_count;
+  unsigned long long free_count;
+
+  mesh_size_class_stats_t size_classes[MESH_MAX_SIZE_CLASSES];
+} mesh_introspect_t;
+
+typedef struct {
+  int enabled;                       /* 0 disables meshing for the class */
+  double occupancy_cutoff;           /* candidates must be below this fullness;
+                                      * clamped to (0, 0.8] (the band ceiling).
+                                      * 0 keeps the library default */
+  unsigned int max_pairs_per_cycle;  /* 0 keeps the library default */
+} mesh_class_policy_t;
+
+/* Direct meshing effort where it pays off: per-size-class
+ * enable/disable, candidate occupancy cutoff, and per-cycle pair
+ * budget.  Returns 0 on success, -1 for a bad class or policy. */
+int mesh_set_class_policy(unsigned int size_class, const mesh_class_policy_t *policy);
+
+/* Fill *stats with a consistent snapshot of allocator state.  Cheap
+ * enough to poll every second: the hot paths only bump plain
+ * per-thread counters, and aggregation happens here, on the reader.
+ * Returns 0 on success, -1 on a version/layout mismatch. */
+int mesh_introspect(mesh_introspect_t *stats);
+
 // 0 if not in bounds, 1 if is.
 int mesh_in_bounds(void *ptr);
 
+/* --- embedding API --------------------------------------------------
+ *
+ * A mesh_heap_t is an isolated allocation domain for embedders (the
+ * Plasma store and friends) that want meshing compaction without
+ * LD_PRELOADing the global allocator: allocations come from the
+ * process's meshing arena, the handle tracks what it owns, and
+ * destroying the handle releases everything still live in it.
+ *
+ * One meshing arena per process remains a structural invariant (the
+ * page index, mesh epoch, and fork protocol all assume it), so heaps
+ * are accounting/lifetime domains over that arena rather than
+ * separate reservations; caller-provided memory or fds are not
+ * supported.
+ */
+
+typedef struct mesh_heap_s mesh_heap_t;
+
+typedef struct {
+  unsigned long long alloc_count;
+  unsigned long long free_count;
+  unsigned long long live_bytes;
+  unsigned long long live_count;
+} mesh_heap_stats_t;
+
+mesh_heap_t *mesh_create_heap(void);
+/* frees everything still allocated from the heap, then the handle */
+void mesh_destroy_heap(mesh_heap_t *heap);
+void *mesh_heap_alloc(mesh_heap_t *heap, size_t size);
+void mesh_heap_free(mesh_heap_t *heap, void *ptr);
+int mesh_heap_stats(mesh_heap_t *heap, mesh_heap_stats_t *stats);
+
 // returns the usable size of an allocation
 size_t mesh_usable_size(void *ptr);
 
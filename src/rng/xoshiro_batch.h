@@ -0,0 +1,88 @@
+// -*- C++ -*-
+
+#ifndef MESH_XOSHIRO_BATCH_H
+#define MESH_XOSHIRO_BATCH_H
+
+#include "../common.h"
+
+/**
+ * @class XoshiroBatch
+ * @brief Four xoshiro256++ streams stepped in lockstep, refilling a
+ *        buffer of random words in one shot.
+ *
+ * The shuffle paths previously drew one value per insert/swap from a
+ * multiply-with-carry generator, whose serial dependency chain shows
+ * up in malloc profiles.  Here the four lanes are independent, so the
+ * refill loop has instruction-level parallelism (and auto-vectorizes
+ * on targets with 256-bit integer ops); consumers then eat
+ * pre-generated 32-bit values with no per-call chain at all.
+ * inRange matches MWC's interface and bounding method.
+ */
+class XoshiroBatch {
+public:
+  static constexpr size_t kStreams = 4;
+  static constexpr size_t kBufLen = 32;  // 64-bit words per refill
+
+  XoshiroBatch(uint64_t seed1, uint64_t seed2) {
+    // expand the two seed words into 4x4 words of state; splitmix64
+    // is the initializer the xoshiro authors recommend
+    uint64_t x = seed1 ^ (seed2 * 0x9E3779B97F4A7C15ULL);
+    for (size_t s = 0; s < kStreams; s++) {
+      for (size_t i = 0; i < 4; i++) {
+        _state[s][i] = splitmix64(x);
+      }
+    }
+  }
+
+  // returns a number between min and max (inclusive)
+  inline unsigned int ATTRIBUTE_ALWAYS_INLINE inRange(size_t min, size_t max) {
+    const size_t range = 1 + max - min;
+    return min + (((uint64_t)next32() * (uint64_t)range) >> 32);
+  }
+
+  inline uint32_t ATTRIBUTE_ALWAYS_INLINE next32() {
+    if (unlikely(_off == kBufLen * 2)) {
+      refill();
+    }
+    return reinterpret_cast<const uint32_t *>(_buf)[_off++];
+  }
+
+private:
+  static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  static inline uint64_t splitmix64(uint64_t &x) {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  void ATTRIBUTE_NEVER_INLINE refill() {
+    for (size_t i = 0; i < kBufLen; i += kStreams) {
+      // one xoshiro256++ step per lane; the lanes are independent
+      for (size_t s = 0; s < kStreams; s++) {
+        uint64_t *st = _state[s];
+        const uint64_t result = rotl(st[0] + st[3], 23) + st[0];
+        const uint64_t t = st[1] << 17;
+
+        st[2] ^= st[0];
+        st[3] ^= st[1];
+        st[1] ^= st[2];
+        st[0] ^= st[3];
+        st[2] ^= t;
+        st[3] = rotl(st[3], 45);
+
+        _buf[i + s] = result;
+      }
+    }
+    _off = 0;
+  }
+
+  uint64_t _state[kStreams][4];
+  uint64_t _buf[kBufLen];
+  uint32_t _off{kBufLen * 2};  // constructed empty
+};
+
+#endif  // MESH_XOSHIRO_BATCH_H
@@ -12,6 +12,7 @@
 #include <sys/types.h>
 
 #ifdef __linux__
+#include <poll.h>
 #include <sys/signalfd.h>
 #endif
 
@@ -27,10 +28,20 @@ const unsigned char SizeMap::class_array_[kClassArraySize] = {
 
 ATTRIBUTE_ALIGNED(CACHELINE_SIZE)
 const int32_t SizeMap::class_to_size_[kClassSizesMax] = {
-    16,  16,  32,  48,  64,  80,  96,  112,  128,  160,  192,  224,   256,
-    320, 384, 448, 512, 640, 768, 896, 1024, 2048, 4096, 8192, 16384,
+    kClassSizes[0],  kClassSizes[1],  kClassSizes[2],  kClassSizes[3],  kClassSizes[4],  kClassSizes[5],
+    kClassSizes[6],  kClassSizes[7],  kClassSizes[8],  kClassSizes[9],  kClassSizes[10], kClassSizes[11],
+    kClassSizes[12], kClassSizes[13], kClassSizes[14], kClassSizes[15], kClassSizes[16], kClassSizes[17],
+    kClassSizes[18], kClassSizes[19], kClassSizes[20], kClassSizes[21], kClassSizes[22], kClassSizes[23],
+    kClassSizes[24], kClassSizes[25], kClassSizes[26], kClassSizes[27], kClassSizes[28], kClassSizes[29],
+    kClassSizes[30], kClassSizes[31], kClassSizes[32],
 };
 
+static_assert(classForSize(1) == 1, "tiny sizes take the smallest class");
+static_assert(classForSize(16) == 1, "16 bytes is class 1, as in class_array_");
+static_assert(classForSize(17) == 2, "rounding up between classes");
+static_assert(classForSize(kMaxSize) == kNumBins - 1, "kMaxSize is the last class");
+static_assert(classForSize(kMaxSize + 1) == -1, "beyond kMaxSize is page-backed");
+
 // const internal::BinToken::Size internal::BinToken::Max = numeric_limits<uint32_t>::max();
 // const internal::BinToken::Size internal::BinToken::MinFlags = numeric_limits<uint32_t>::max() - 4;
 
@@ -119,6 +130,8 @@ void Runtime::initMaxMapCount() {
   const auto meshCount = static_cast<size_t>(kMeshesPerMap * mapCount);
 
   _heap.setMaxMeshCount(meshCount);
+  _heap.setMapBudget(static_cast<size_t>(mapCount));
+  _heap.updateVmaBudget();
 }
 
 int Runtime::createThread(pthread_t *thread, const pthread_attr_t *attr, PthreadFn startRoutine, void *arg) {
@@ -173,6 +186,7 @@ void Runtime::createSignalFd() {
   sigset_t mask;
   sigemptyset(&mask);
   sigaddset(&mask, SIGDUMP);
+  sigaddset(&mask, SIGTRIM);
 
   /* Block signals so that they aren't handled
      according to their default dispositions */
@@ -213,6 +227,39 @@ void *Runtime::bgThread(void *arg) {
 
 #ifdef __linux__
   while (true) {
+    struct pollfd pfd;
+    pfd.fd = rt._signalFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    const int nfds = poll(&pfd, 1, kScavengeIntervalMs.count());
+    if (nfds == 0) {
+      // timeout: release a bounded batch of dirty pages, so page
+      // release happens off the allocation paths and is rate-limited
+      // by the poll interval
+      rt.heap().backgroundScavenge();
+
+      // re-measure the process VMA count about once a second; other
+      // libraries' mappings count against the same kernel limit.
+      // Calibrate the committed-page estimate against smaps less
+      // often still -- that parse costs real kernel time on big heaps.
+      static size_t ticks = 0;
+      ticks++;
+      if (ticks % 20 == 0) {
+        rt.heap().updateVmaBudget();
+      }
+      if (ticks % 100 == 0) {
+        rt.heap().calibrateCommittedEstimate();
+      }
+      continue;
+    }
+    if (nfds < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return nullptr;
+    }
+
     struct signalfd_siginfo siginfo;
 
     ssize_t s = read(rt._signalFd, &siginfo, sizeof(struct signalfd_siginfo));
@@ -226,7 +273,10 @@ void *Runtime::bgThread(void *arg) {
       }
     }
 
-    if (static_cast<int>(siginfo.ssi_signo) == SIGDUMP) {
+    if (static_cast<int>(siginfo.ssi_signo) == SIGTRIM) {
+      // container is under memory pressure: give back everything we can
+      rt.heap().trim(0);
+    } else if (static_cast<int>(siginfo.ssi_signo) == SIGDUMP) {
       // debug("libmesh: background thread received SIGDUMP, starting dump\n");
       debug(">>>>>>>>>>\n");
       rt.heap().dumpStrings();
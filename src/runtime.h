@@ -51,6 +51,14 @@ public:
     _heap.setMeshPeriodMs(period);
   }
 
+  void setMeshPauseBudgetUs(std::chrono::microseconds budget) {
+    _heap.setMeshPauseBudgetUs(budget);
+  }
+
+  void setMeshPolicy(std::chrono::milliseconds minPeriod, std::chrono::milliseconds maxPeriod, bool adaptive) {
+    _heap.setMeshPolicy(minPeriod, maxPeriod, adaptive);
+  }
+
 #ifdef __linux__
   int epollWait(int __epfd, struct epoll_event *__events, int __maxevents, int __timeout);
   int epollPwait(int __epfd, struct epoll_event *__events, int __maxevents, int __timeout, const __sigset_t *__ss);
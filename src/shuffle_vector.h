@@ -12,6 +12,7 @@
 #include <utility>
 
 #include "rng/mwc.h"
+#include "rng/xoshiro_batch.h"
 
 #include "internal.h"
 
@@ -84,31 +85,44 @@ public:
 
     internal::RelaxedFixedBitmap localBits{static_cast<uint32_t>(_maxCount)};
     bitmap.setAndExchangeAll(localBits.mut_bits(), newBitmap.bits());
-    localBits.invert();
 
     uint32_t allocCount = 0;
 
+    // walk the snapshot a word at a time, extracting each free offset
+    // with a count-trailing-zeros rather than testing all 256 bits
+    // individually.  Masking each word to _maxCount up front also
+    // retires the old per-bit `i >= maxCount` break.
+    constexpr uint32_t kWordBits = sizeof(size_t) * 8;
     const uint32_t maxCount = static_cast<uint32_t>(_maxCount);
-    for (auto const &i : localBits) {
-      // FIXME: this incredibly lurky conditional is because
-      // RelaxedFixedBitmap iterates over all 256 bits it has,
-      // regardless of the _maxCount set in the constructor -- we
-      // should fix that.
-      if (i >= maxCount) {
-        break;
+    const size_t *occupied = localBits.bits();
+
+    for (uint32_t w = 0; w * kWordBits < maxCount; w++) {
+      const uint32_t baseOff = w * kWordBits;
+      const uint32_t validBits = std::min(kWordBits, maxCount - baseOff);
+
+      // the zero bits of the old word are the offsets we just claimed
+      size_t freeBits = ~occupied[w];
+      if (validBits < kWordBits) {
+        freeBits &= (1UL << validBits) - 1;
       }
 
-      if (unlikely(isFull())) {
-        // TODO: we don't have any more space in our shuffle vector
-        // for these bits we've pulled out of the MiniHeap's bitmap,
-        // so we need to set them as free again.  we should measure
-        // how often this happens, as its gonna be slow
-        refillFullSlowpath(bitmap, i);
-      } else {
+      while (freeBits != 0) {
+        const uint32_t off = baseOff + __builtin_ctzll(freeBits);
+        freeBits &= freeBits - 1;
+
+        if (unlikely(isFull())) {
+          // TODO: we don't have any more space in our shuffle vector
+          // for these bits we've pulled out of the MiniHeap's bitmap,
+          // so we need to set them as free again.  we should measure
+          // how often this happens, as its gonna be slow
+          refillFullSlowpath(bitmap, off);
+          continue;
+        }
+
         _off--;
         d_assert(_off >= 0);
         d_assert(_off < _maxCount);
-        _list[_off] = sv::Entry{mhOffset, static_cast<uint8_t>(i)};
+        _list[_off] = sv::Entry{mhOffset, static_cast<uint8_t>(off)};
         allocCount++;
       }
     }
@@ -252,6 +266,37 @@ public:
     return _objectSize;
   }
 
+  // --- adaptive cache depth -----------------------------------------
+  // how many miniheaps the next global refill should attach; shrunk
+  // for cold classes by the owner's decay pass, re-grown when the
+  // class turns hot again
+
+  inline uint32_t targetAttach() const {
+    return _targetAttach;
+  }
+
+  inline void setTargetAttach(uint32_t target) {
+    d_assert(target >= 2 && target <= kMaxMiniheapsPerShuffleVector);
+    _targetAttach = target;
+  }
+
+  inline void shrinkTarget() {
+    _targetAttach = _targetAttach > 4 ? _targetAttach / 2 : 2;
+  }
+
+  inline void noteRefill() {
+    _refillsSinceDecay++;
+  }
+
+  inline uint32_t refillsSinceDecay() const {
+    return _refillsSinceDecay;
+  }
+
+  inline void resetRefillsSinceDecay() {
+    _refillsSinceDecay = 0;
+  }
+  // ------------------------------------------------------------------
+
   // called once, on initialization of ThreadLocalHeap
   inline void initialInit(const char *arenaBegin, uint32_t sz) {
     _arenaBegin = arenaBegin;
@@ -272,9 +317,11 @@ private:
   int16_t _off{0};                                                           // 2   44
   uint32_t _objectSize{0};                                                   // 4   48
   FixedArray<MiniHeap, kMaxMiniheapsPerShuffleVector> _attachedMiniheaps{};  // 36  128
-  MWC _prng;                                                                 // 36  84
+  XoshiroBatch _prng;                                                        //
   float _objectSizeReciprocal{0.0};                                          // 4   88
   uint32_t _attachedOff{0};                                                  //
+  uint32_t _targetAttach{kMaxMiniheapsPerShuffleVector};                     //
+  uint32_t _refillsSinceDecay{0};                                            //
   sv::Entry _list[kMaxShuffleVectorLength] CACHELINE_ALIGNED;                // 512 640
 };
 
@@ -60,6 +60,17 @@ static void ATTRIBUTE_NEVER_INLINE initAndRefill(FixedArray<MiniHeap, kMiniHeapC
   }
 }
 
+static void ATTRIBUTE_NEVER_INLINE initializeMiniHeapsEmpty(FixedArray<MiniHeap, kMiniHeapCount> &miniheaps) {
+  for (size_t i = 0; i < kMiniHeapCount; i++) {
+    MiniHeap *mh = miniheaps[i];
+
+    auto bits = mh->writableBitmap().mut_bits();
+    for (size_t j = 0; j < 4; j++) {
+      bits[j] = 0;
+    }
+  }
+}
+
 static void BM_LocalRefill1(benchmark::State &state) {
   mesh::debug("local refill test!\n");
   const auto tid = gettid();
@@ -100,4 +111,33 @@ static void BM_LocalRefill1(benchmark::State &state) {
 }
 BENCHMARK(BM_LocalRefill1);
 
+// all-free miniheaps: every refill pulls a full word's worth of
+// offsets at once, which is the best case for the word-at-a-time
+// extraction in refillFrom (and the worst case for per-bit iteration)
+static void BM_LocalRefillEmpty(benchmark::State &state) {
+  const auto tid = gettid();
+  GlobalHeap &gheap = runtime().heap();
+
+  gheap.setMeshPeriodMs(kZeroMs);
+
+  static FixedArray<MiniHeap, kMiniHeapCount> array{};
+  if (array.size() == 0) {
+    gheap.allocSmallMiniheaps(SizeMap::SizeClass(kObjSize), kObjSize, array, tid);
+  }
+
+  initializeMiniHeapsEmpty(array);
+
+  ShuffleVector sv{};
+  sv.initialInit(gheap.arenaBegin(), kObjSize);
+
+  size_t n = 0;
+
+  for (auto _ : state) {
+    initAndRefill(array, n, sv);
+  }
+
+  sv.miniheaps().clear();
+}
+BENCHMARK(BM_LocalRefillEmpty);
+
 BENCHMARK_MAIN();
@@ -0,0 +1,228 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright 2020 The Mesh Authors. All rights reserved.
+// Use of this source code is governed by the Apache License,
+// Version 2.0, that can be found in the LICENSE file.
+
+// Microbenchmarks for the allocator hot paths, meant to be diffed in
+// CI.  Run with fixed iteration protocols + percentile aggregates:
+//
+//   bazel run //src:micro-benchmark -- \
+//       --benchmark_repetitions=9 --benchmark_report_aggregates_only=true \
+//       --benchmark_format=json > bench.json
+//
+// Each benchmark registers p50/p99 statistics over its repetitions so
+// the JSON can be compared run-over-run without post-processing.
+
+#include <atomic>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "global_heap.h"
+#include "internal.h"
+#include "meshing.h"
+#include "runtime.h"
+#include "thread_local_heap.h"
+
+using namespace mesh;
+
+static double percentile50(const std::vector<double> &v) {
+  std::vector<double> sorted{v};
+  std::sort(sorted.begin(), sorted.end());
+  return sorted[sorted.size() / 2];
+}
+
+static double percentile99(const std::vector<double> &v) {
+  std::vector<double> sorted{v};
+  std::sort(sorted.begin(), sorted.end());
+  return sorted[(sorted.size() * 99) / 100];
+}
+
+#define MESH_BENCHMARK(fn) \
+  BENCHMARK(fn)->ComputeStatistics("p50", percentile50)->ComputeStatistics("p99", percentile99)
+
+// --- malloc/free hot path -------------------------------------------
+
+static void BM_MallocFree(benchmark::State &state) {
+  const size_t size = static_cast<size_t>(state.range(0));
+  ThreadLocalHeap *heap = ThreadLocalHeap::GetHeap();
+
+  for (auto _ : state) {
+    void *ptr = heap->malloc(size);
+    benchmark::DoNotOptimize(ptr);
+    heap->free(ptr);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+MESH_BENCHMARK(BM_MallocFree)->Arg(16)->Arg(64)->Arg(256)->Arg(1024)->Arg(8192);
+
+// --- page-backed allocation -----------------------------------------
+
+static void BM_PageAlloc(benchmark::State &state) {
+  const size_t size = static_cast<size_t>(state.range(0));
+  ThreadLocalHeap *heap = ThreadLocalHeap::GetHeap();
+
+  for (auto _ : state) {
+    void *ptr = heap->malloc(size);
+    benchmark::DoNotOptimize(ptr);
+    heap->free(ptr);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+MESH_BENCHMARK(BM_PageAlloc)->Arg(512 * 1024)->Arg(1024 * 1024);
+
+// --- cross-thread free ----------------------------------------------
+//
+// even threads allocate into a shared mailbox, odd threads free what
+// they find there -- the free always happens on a non-owning thread.
+
+static constexpr size_t kMailboxSlots = 512;
+static std::atomic<void *> gMailbox[kMailboxSlots];
+
+static void BM_CrossThreadFree(benchmark::State &state) {
+  ThreadLocalHeap *heap = ThreadLocalHeap::GetHeap();
+  const bool producer = state.thread_index % 2 == 0;
+  size_t slot = 0;
+
+  for (auto _ : state) {
+    slot = (slot + 1) % kMailboxSlots;
+    if (producer) {
+      void *ptr = heap->malloc(64);
+      void *expected = nullptr;
+      if (!gMailbox[slot].compare_exchange_strong(expected, ptr, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+        // mailbox full; free locally so we don't leak
+        heap->free(ptr);
+      }
+    } else {
+      void *ptr = gMailbox[slot].exchange(nullptr, std::memory_order_acquire);
+      if (ptr != nullptr) {
+        heap->free(ptr);
+      }
+    }
+  }
+
+  // drain whatever is left
+  if (state.thread_index == 0) {
+    for (size_t i = 0; i < kMailboxSlots; i++) {
+      void *ptr = gMailbox[i].exchange(nullptr);
+      if (ptr != nullptr) {
+        heap->free(ptr);
+      }
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+MESH_BENCHMARK(BM_CrossThreadFree)->Threads(2)->Threads(4);
+
+// --- bitmapsMeshable throughput -------------------------------------
+
+static void BM_BitmapsMeshable(benchmark::State &state) {
+  // two non-overlapping bitmaps: the kernel has to scan every word
+  internal::Bitmap left{256};
+  internal::Bitmap right{256};
+  for (size_t i = 0; i < 256; i += 2) {
+    left.tryToSet(i);
+    right.tryToSet(i + 1);
+  }
+
+  for (auto _ : state) {
+    bool meshable = mesh::bitmapsMeshable(left.bits(), right.bits(), 32);
+    benchmark::DoNotOptimize(meshable);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+MESH_BENCHMARK(BM_BitmapsMeshable);
+
+static void BM_BitmapsMeshableBatch(benchmark::State &state) {
+  internal::Bitmap left{256};
+  static internal::Bitmap *rights[kMaxMeshableBatchSize];
+  const internal::Bitmap::word_t *rightBits[kMaxMeshableBatchSize];
+
+  for (size_t i = 0; i < 256; i += 2) {
+    left.tryToSet(i);
+  }
+  for (size_t i = 0; i < kMaxMeshableBatchSize; i++) {
+    if (rights[i] == nullptr) {
+      rights[i] = new internal::Bitmap{256};
+      for (size_t j = 1; j < 256; j += 2) {
+        rights[i]->tryToSet(j);
+      }
+    }
+    rightBits[i] = rights[i]->bits();
+  }
+
+  for (auto _ : state) {
+    uint64_t meshable = mesh::bitmapsMeshableBatch(left.bits(), rightBits, kMaxMeshableBatchSize, 32);
+    benchmark::DoNotOptimize(meshable);
+  }
+
+  state.SetItemsProcessed(state.iterations() * kMaxMeshableBatchSize);
+}
+MESH_BENCHMARK(BM_BitmapsMeshableBatch);
+
+// --- refill (seeded from local_refill.cc) ---------------------------
+
+static void BM_GlobalRefill(benchmark::State &state) {
+  GlobalHeap &gheap = runtime().heap();
+  gheap.setMeshPeriodMs(kZeroMs);
+  const auto tid = gettid();
+
+  ShuffleVector sv{};
+  sv.initialInit(gheap.arenaBegin(), 16);
+
+  for (auto _ : state) {
+    gheap.allocSmallMiniheaps(SizeMap::SizeClass(16), 16, sv.miniheaps(), tid);
+    sv.reinit();
+    benchmark::DoNotOptimize(sv.isExhausted());
+    sv.refillMiniheaps();
+    gheap.releaseMiniheaps(sv.miniheaps());
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+MESH_BENCHMARK(BM_GlobalRefill);
+
+// --- mesh cycle latency ---------------------------------------------
+//
+// builds fragmentation (allocate a lot, free every other object),
+// then measures a forced compaction through the public mallctl.
+
+static void BM_MeshCycle(benchmark::State &state) {
+  ThreadLocalHeap *heap = ThreadLocalHeap::GetHeap();
+  GlobalHeap &gheap = runtime().heap();
+  gheap.setMeshPeriodMs(kZeroMs);
+
+  static constexpr size_t kObjects = 1 << 16;
+  static void *ptrs[kObjects];
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (size_t i = 0; i < kObjects; i++) {
+      ptrs[i] = heap->malloc(256);
+    }
+    for (size_t i = 0; i < kObjects; i += 2) {
+      heap->free(ptrs[i]);
+      ptrs[i] = nullptr;
+    }
+    state.ResumeTiming();
+
+    size_t arg = 0;
+    size_t argLen = sizeof(arg);
+    gheap.mallctl("mesh.compact", &arg, &argLen, nullptr, 0);
+
+    state.PauseTiming();
+    for (size_t i = 1; i < kObjects; i += 2) {
+      heap->free(ptrs[i]);
+      ptrs[i] = nullptr;
+    }
+    state.ResumeTiming();
+  }
+}
+MESH_BENCHMARK(BM_MeshCycle)->Unit(benchmark::kMillisecond)->Iterations(8);
+
+BENCHMARK_MAIN();
@@ -6,7 +6,14 @@ static constexpr size_t kMinAllocSz = 800000;
 static constexpr size_t kMaxAllocSz = 900000;
 static constexpr unsigned kMaxLiveAlloc = 128;  // keep no more than 128 * kMaxAllocSz memory allocated.
 
-int main(void) {
+int main(int argc, char *argv[]) {
+  // an optional iteration bound lets the regression suite run this to
+  // completion; with no argument it churns forever, as before
+  size_t iterations = 0;
+  if (argc > 1) {
+    iterations = strtoull(argv[1], nullptr, 10);
+  }
+
   std::vector<void *> alloc(kMaxLiveAlloc, nullptr);
   for (size_t i = 0; i < kMaxLiveAlloc; i++) {
     if (alloc[i] != nullptr) {
@@ -14,12 +21,16 @@ int main(void) {
     }
   }
 
-  while (1) {
+  for (size_t i = 0; iterations == 0 || i < iterations; i++) {
     const size_t ix = rand() % kMaxLiveAlloc;
     const size_t sz = (rand() % (kMaxAllocSz - kMinAllocSz)) + kMinAllocSz;
 
     free(alloc[ix]);
     alloc[ix] = malloc(sz);
   }
+
+  for (size_t i = 0; i < kMaxLiveAlloc; i++) {
+    free(alloc[i]);
+  }
   return 0;
 }
@@ -0,0 +1,67 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright 2020 The Mesh Authors. All rights reserved.
+// Use of this source code is governed by the Apache License,
+// Version 2.0, that can be found in the LICENSE file.
+
+// Redis-like churn: a large live set of small mixed-size values with
+// random replacement, the shape that leaves partially-occupied spans
+// everywhere and gives meshing something to reclaim.  Deterministic
+// (fixed seed, fixed iteration count) so RSS-over-time curves are
+// comparable run over run.
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+static constexpr size_t kLiveObjects = 1 << 19;  // ~512k live values
+static constexpr size_t kIterations = 1 << 23;
+
+// mixed value sizes, roughly a cache's key/value mix
+static const size_t kSizes[] = {16, 24, 48, 64, 96, 128, 256, 384, 1024};
+static constexpr size_t kSizeCount = sizeof(kSizes) / sizeof(kSizes[0]);
+
+int main(int argc, char *argv[]) {
+  size_t iterations = kIterations;
+  if (argc > 1) {
+    iterations = strtoull(argv[1], nullptr, 10);
+  }
+
+  srand48(1234567);
+
+  char **live = reinterpret_cast<char **>(calloc(kLiveObjects, sizeof(char *)));
+  if (live == nullptr) {
+    return 1;
+  }
+
+  // build up the live set
+  for (size_t i = 0; i < kLiveObjects; i++) {
+    const size_t sz = kSizes[lrand48() % kSizeCount];
+    live[i] = reinterpret_cast<char *>(malloc(sz));
+    memset(live[i], 0x5a, sz);
+  }
+
+  // churn: replace random entries, occasionally dropping a run of
+  // them entirely so occupancy actually falls
+  for (size_t i = 0; i < iterations; i++) {
+    const size_t ix = lrand48() % kLiveObjects;
+
+    if (i % 64 == 0) {
+      free(live[ix]);
+      live[ix] = nullptr;
+      continue;
+    }
+
+    free(live[ix]);
+    const size_t sz = kSizes[lrand48() % kSizeCount];
+    live[ix] = reinterpret_cast<char *>(malloc(sz));
+    memset(live[ix], 0xa5, sz);
+  }
+
+  for (size_t i = 0; i < kLiveObjects; i++) {
+    free(live[i]);
+  }
+  free(live);
+
+  printf("churn: done (%zu iterations)\n", iterations);
+  return 0;
+}
@@ -0,0 +1,80 @@
+#!/bin/sh
+# Copyright 2020 The Mesh Authors. All rights reserved.
+# Use of this source code is governed by the Apache License,
+# Version 2.0, that can be found in the LICENSE file.
+#
+# RSS-over-time fragmentation regression driver.
+#
+#   rss_regression.sh <libmesh.so> <workload> <min-meshed-pages> [workload args...]
+#
+# Runs the workload under LD_PRELOAD, samples VmRSS from /proc every
+# 200ms into <workload>.rss.csv (an RSS-vs-time curve suitable for
+# diffing between release candidates), and fails unless the allocator's
+# exit stats report at least <min-meshed-pages> meshed pages at the
+# high-water mark -- the signal that candidate-selection regressions
+# (less reclaimed memory) show up in first.
+
+set -u
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 <libmesh.so> <workload> <min-meshed-pages> [args...]" >&2
+    exit 2
+fi
+
+MESH_LIB="$1"
+WORKLOAD="$2"
+MIN_MESHED_PAGES="$3"
+shift 3
+
+if [ ! -e "$MESH_LIB" ]; then
+    echo "FAIL: libmesh not found at $MESH_LIB" >&2
+    exit 2
+fi
+
+OUT_DIR="${TEST_UNDECLARED_OUTPUTS_DIR:-.}"
+CSV="$OUT_DIR/$(basename "$WORKLOAD").rss.csv"
+STATS="$OUT_DIR/$(basename "$WORKLOAD").stats"
+
+# a short mesh period so reclamation happens within the workload's
+# runtime; MALLOCSTATS dumps the meshed-page counters at exit
+LD_PRELOAD="$MESH_LIB" MALLOCSTATS=1 MESH_PERIOD_MS=20 \
+    "$WORKLOAD" "$@" 2> "$STATS" &
+PID=$!
+
+echo "ms,rss_kb" > "$CSV"
+START_MS=$(($(date +%s%N) / 1000000))
+while kill -0 "$PID" 2> /dev/null; do
+    RSS_KB=$(awk '/^VmRSS:/ { print $2 }' "/proc/$PID/status" 2> /dev/null)
+    if [ -n "${RSS_KB:-}" ]; then
+        NOW_MS=$(($(date +%s%N) / 1000000))
+        echo "$((NOW_MS - START_MS)),$RSS_KB" >> "$CSV"
+    fi
+    sleep 0.2
+done
+
+wait "$PID"
+STATUS=$?
+if [ "$STATUS" -ne 0 ]; then
+    echo "FAIL: workload exited with status $STATUS" >&2
+    exit 1
+fi
+
+# dumpStats writes "Meshed pages HWM:   <n>"
+MESHED_HWM=$(awk '/Meshed pages HWM:/ { print $NF }' "$STATS")
+if [ -z "${MESHED_HWM:-}" ]; then
+    echo "FAIL: no meshed-page stats in workload output (is MALLOCSTATS plumbed?)" >&2
+    cat "$STATS" >&2
+    exit 1
+fi
+
+PEAK_KB=$(awk -F, 'NR > 1 && $2 > max { max = $2 } END { print max }' "$CSV")
+echo "meshed pages HWM: $MESHED_HWM (bound: $MIN_MESHED_PAGES), peak RSS: ${PEAK_KB:-?} kB"
+echo "rss curve: $CSV"
+
+if [ "$MESHED_HWM" -lt "$MIN_MESHED_PAGES" ]; then
+    echo "FAIL: meshed-page savings regressed: $MESHED_HWM < $MIN_MESHED_PAGES" >&2
+    exit 1
+fi
+
+echo "PASS"
+exit 0
@@ -272,3 +272,32 @@ TEST(BitmapTest, SetHalf) {
     ASSERT_TRUE(bitmap.inUseCount() == nBits / 2);
   }
 }
+
+TEST(BitmapTest, UnsetMask) {
+  mesh::internal::Bitmap bits{256};
+
+  bits.tryToSet(0);
+  bits.tryToSet(63);
+  bits.tryToSet(64);
+  bits.tryToSet(200);
+
+  // clear bits 0 and 64; leave 63 and 200 alone
+  size_t mask[4] = {1UL, 1UL, 0, 0};
+  size_t oldBits[4] = {0, 0, 0, 0};
+  bits.unsetMask(mask, oldBits);
+
+  // the old words report what was set before the clear
+  ASSERT_EQ(oldBits[0], (1UL | (1UL << 63)));
+  ASSERT_EQ(oldBits[1], 1UL);
+
+  ASSERT_FALSE(bits.isSet(0));
+  ASSERT_TRUE(bits.isSet(63));
+  ASSERT_FALSE(bits.isSet(64));
+  ASSERT_TRUE(bits.isSet(200));
+
+  // clearing an already-clear bit is a no-op
+  bits.unsetMask(mask, oldBits);
+  ASSERT_EQ(oldBits[0], (1UL << 63));
+  ASSERT_TRUE(bits.isSet(63));
+  ASSERT_TRUE(bits.isSet(200));
+}
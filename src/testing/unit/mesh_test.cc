@@ -141,3 +141,43 @@ TEST(MeshTest, TryMesh) {
 TEST(MeshTest, TryMeshInverse) {
   meshTest(true);
 }
+
+TEST(GlobalHeap, OccupancyBandFor) {
+  // bands: [0,.25), [.25,.5), [.5,.8), >= .8
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(0, 256), 0U);
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(63, 256), 0U);
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(64, 256), 1U);
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(127, 256), 1U);
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(128, 256), 2U);
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(204, 256), 2U);
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(205, 256), kOccupancyBands - 1);
+  ASSERT_EQ(GlobalHeap::occupancyBandFor(256, 256), kOccupancyBands - 1);
+}
+
+TEST(GlobalHeap, PendingFreeStash) {
+  PendingFreeStash stash;
+
+  // empty pops nothing
+  ASSERT_FALSE(stash.pop().hasValue());
+
+  // fill every slot, then one more push must report full
+  for (uint32_t i = 1; i <= PendingFreeStash::kSlots; i++) {
+    ASSERT_TRUE(stash.push(MiniHeapID{i}));
+  }
+  ASSERT_FALSE(stash.push(MiniHeapID{9999}));
+
+  // drain: every pushed id comes back exactly once
+  bool seen[PendingFreeStash::kSlots + 1] = {};
+  for (uint32_t i = 0; i < PendingFreeStash::kSlots; i++) {
+    const MiniHeapID id = stash.pop();
+    ASSERT_TRUE(id.hasValue());
+    ASSERT_LE(id.value(), PendingFreeStash::kSlots);
+    ASSERT_FALSE(seen[id.value()]);
+    seen[id.value()] = true;
+  }
+  ASSERT_FALSE(stash.pop().hasValue());
+
+  // reusable after draining
+  ASSERT_TRUE(stash.push(MiniHeapID{42}));
+  ASSERT_EQ(stash.pop().value(), 42U);
+}
@@ -0,0 +1,184 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright 2020 The Mesh Authors. All rights reserved.
+// Use of this source code is governed by the Apache License,
+// Version 2.0, that can be found in the LICENSE file.
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "gtest/gtest.h"
+
+#include "meshable_arena.h"
+
+using namespace mesh;
+
+TEST(SpanSet, TakeFromEmpty) {
+  SpanSet set;
+  Span result(0, 0);
+
+  ASSERT_TRUE(set.empty());
+  ASSERT_FALSE(set.take(1, result));
+  ASSERT_FALSE(set.takeLargest(result));
+}
+
+TEST(SpanSet, TakeExact) {
+  SpanSet set;
+  set.insert(Span(10, 4));
+
+  Span result(0, 0);
+  ASSERT_TRUE(set.take(4, result));
+  ASSERT_EQ(result.offset, 10U);
+  ASSERT_EQ(result.length, 4U);
+  ASSERT_TRUE(set.empty());
+}
+
+TEST(SpanSet, TakeWithRemainder) {
+  SpanSet set;
+  set.insert(Span(10, 8));
+
+  Span result(0, 0);
+  ASSERT_TRUE(set.take(3, result));
+  ASSERT_EQ(result.offset, 10U);
+  ASSERT_EQ(result.length, 3U);
+
+  // the remainder stays free and is still one span
+  Span rest(0, 0);
+  ASSERT_TRUE(set.take(5, rest));
+  ASSERT_EQ(rest.offset, 13U);
+  ASSERT_EQ(rest.length, 5U);
+  ASSERT_TRUE(set.empty());
+}
+
+TEST(SpanSet, TakeBestFit) {
+  SpanSet set;
+  set.insert(Span(0, 16));
+  set.insert(Span(100, 4));
+
+  // the smaller sufficient span wins, leaving the big one intact
+  Span result(0, 0);
+  ASSERT_TRUE(set.take(4, result));
+  ASSERT_EQ(result.offset, 100U);
+  ASSERT_EQ(result.length, 4U);
+
+  ASSERT_TRUE(set.takeLargest(result));
+  ASSERT_EQ(result.offset, 0U);
+  ASSERT_EQ(result.length, 16U);
+}
+
+TEST(SpanSet, InsertMergesLeft) {
+  SpanSet set;
+  set.insert(Span(10, 4));
+  set.insert(Span(14, 4));
+
+  Span result(0, 0);
+  ASSERT_TRUE(set.take(8, result));
+  ASSERT_EQ(result.offset, 10U);
+  ASSERT_EQ(result.length, 8U);
+  ASSERT_TRUE(set.empty());
+}
+
+TEST(SpanSet, InsertMergesRight) {
+  SpanSet set;
+  set.insert(Span(14, 4));
+  set.insert(Span(10, 4));
+
+  Span result(0, 0);
+  ASSERT_TRUE(set.take(8, result));
+  ASSERT_EQ(result.offset, 10U);
+  ASSERT_EQ(result.length, 8U);
+}
+
+TEST(SpanSet, InsertMergesBothSides) {
+  SpanSet set;
+  set.insert(Span(10, 4));
+  set.insert(Span(18, 4));
+  // filling the hole fuses all three
+  set.insert(Span(14, 4));
+
+  Span result(0, 0);
+  ASSERT_TRUE(set.take(12, result));
+  ASSERT_EQ(result.offset, 10U);
+  ASSERT_EQ(result.length, 12U);
+  ASSERT_TRUE(set.empty());
+}
+
+TEST(SpanSet, InsertNoMergeAcrossGap) {
+  SpanSet set;
+  set.insert(Span(10, 4));
+  set.insert(Span(15, 4));  // one-page hole at 14
+
+  Span result(0, 0);
+  ASSERT_FALSE(set.take(8, result));
+  ASSERT_TRUE(set.take(4, result));
+  ASSERT_TRUE(set.take(4, result));
+}
+
+TEST(SpanSet, ClaimRangeExact) {
+  SpanSet set;
+  set.insert(Span(10, 4));
+
+  ASSERT_TRUE(set.claimRange(10, 4));
+  ASSERT_TRUE(set.empty());
+}
+
+TEST(SpanSet, ClaimRangeCarvesMiddle) {
+  SpanSet set;
+  set.insert(Span(10, 10));
+
+  ASSERT_TRUE(set.claimRange(13, 4));
+
+  // both remainders survive, un-merged (there's a hole between them)
+  Span result(0, 0);
+  ASSERT_TRUE(set.take(3, result));
+  ASSERT_EQ(result.offset, 10U);
+  ASSERT_TRUE(set.take(3, result));
+  ASSERT_EQ(result.offset, 17U);
+  ASSERT_TRUE(set.empty());
+}
+
+TEST(SpanSet, ClaimRangeStraddleFails) {
+  SpanSet set;
+  set.insert(Span(10, 4));
+  set.insert(Span(14, 2));  // merged into [10, 16)
+  set.insert(Span(20, 4));
+
+  // covered entirely by the merged span: fine
+  ASSERT_TRUE(set.claimRange(12, 4));
+  // straddles the [16, 20) hole: must fail
+  ASSERT_FALSE(set.claimRange(15, 6));
+  // entirely within the hole: must fail
+  ASSERT_FALSE(set.claimRange(16, 2));
+  // runs past the end of the last span: must fail
+  ASSERT_FALSE(set.claimRange(22, 4));
+}
+
+TEST(SpanSet, ClaimRangeMissWhenEmpty) {
+  SpanSet set;
+  ASSERT_FALSE(set.claimRange(0, 1));
+}
+
+TEST(SpanSet, ForEachIsOffsetSorted) {
+  SpanSet set;
+  set.insert(Span(30, 2));
+  set.insert(Span(10, 2));
+  set.insert(Span(20, 2));
+
+  Offset last = 0;
+  size_t count = 0;
+  set.forEach([&](const Span &span) {
+    ASSERT_GE(span.offset, last);
+    last = span.offset;
+    count++;
+  });
+  ASSERT_EQ(count, 3UL);
+}
+
+TEST(SpanSet, Clear) {
+  SpanSet set;
+  set.insert(Span(10, 4));
+  set.clear();
+
+  Span result(0, 0);
+  ASSERT_TRUE(set.empty());
+  ASSERT_FALSE(set.take(1, result));
+}
@@ -4,6 +4,9 @@
 // Version 2.0, that can be found in the LICENSE file.
 
 #include "thread_local_heap.h"
+#include "tracepoints.h"
+
+#include <fcntl.h>
 
 namespace mesh {
 
@@ -14,13 +17,349 @@ ThreadLocalHeap *ThreadLocalHeap::_threadLocalHeaps{nullptr};
 bool ThreadLocalHeap::_tlhInitialized{false};
 pthread_key_t ThreadLocalHeap::_heapKey{0};
 
+bool ThreadLocalHeap::_perCpuMode{false};
+ThreadLocalHeap **ThreadLocalHeap::_cpuHeaps{nullptr};
+size_t ThreadLocalHeap::_cpuHeapCount{0};
+
+static ThreadLocalHeap **allocCpuHeaps(size_t count) {
+  auto heaps =
+      reinterpret_cast<ThreadLocalHeap **>(mesh::internal::Heap().malloc(count * sizeof(ThreadLocalHeap *)));
+  hard_assert(heaps != nullptr);
+
+  for (size_t i = 0; i < count; i++) {
+    void *buf = mesh::internal::Heap().malloc(sizeof(ThreadLocalHeap));
+    hard_assert(buf != nullptr);
+    // per-CPU heaps are shared and never registered with the pthread
+    // key or the thread-local heap list; each gets a distinct
+    // negative owner id so its attached miniheaps test as its own
+    heaps[i] = new (buf) ThreadLocalHeap(&mesh::runtime().heap(), pthread_self(), -static_cast<pid_t>(i + 1));
+  }
+
+  return heaps;
+}
+
+void ThreadLocalHeap::EnablePerCpuMode() {
+  if (_perCpuMode) {
+    return;
+  }
+
+#ifdef __linux__
+  long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+#else
+  long ncpu = 1;
+#endif
+  if (ncpu < 1) {
+    ncpu = 1;
+  }
+
+  _cpuHeapCount = static_cast<size_t>(ncpu);
+  _cpuHeaps = allocCpuHeaps(_cpuHeapCount);
+  _perCpuMode = true;
+}
+
+void ThreadLocalHeap::ResetCpuHeapsAfterFork() {
+  if (!_perCpuMode) {
+    return;
+  }
+
+  // heaps (and any spinlocks) owned by threads that died in the fork
+  // are abandoned, not torn down: their cache state may be mid-update.
+  // The attached miniheaps leak in the child, bounded by core count.
+  _cpuHeaps = allocCpuHeaps(_cpuHeapCount);
+}
+
+ThreadLocalHeap::RecycleShard ThreadLocalHeap::_recycleShards[kRecycleShards]{};
+atomic<pid_t> ThreadLocalHeap::_nextParkedId{-1000000};
+atomic_size_t ThreadLocalHeap::_retiredAllocCount{0};
+atomic_size_t ThreadLocalHeap::_retiredFreeCount{0};
+
+size_t ThreadLocalHeap::recycleShardIndex() {
+#ifdef __linux__
+  const int cpu = sched_getcpu();
+  if (likely(cpu >= 0)) {
+    return static_cast<size_t>(cpu) % kRecycleShards;
+  }
+#endif
+  return 0;
+}
+
+// caller must already have flushed the heap's buffers and unlinked it
+// from the live-heap list (see DestroyThreadLocalHeap); this only
+// folds counters, re-tags, and pushes onto a shard
+bool ThreadLocalHeap::TryRecycle(ThreadLocalHeap *heap) {
+  d_assert(heap->_prev == nullptr && _threadLocalHeaps != heap);
+
+  // fold the dead thread's counters into the retired totals; parked
+  // heaps aren't walked by AggregateStatsLocked
+  _retiredAllocCount.fetch_add(heap->_stats.allocCount, std::memory_order_relaxed);
+  _retiredFreeCount.fetch_add(heap->_stats.freeCount, std::memory_order_relaxed);
+  heap->_stats.allocCount = 0;
+  heap->_stats.freeCount = 0;
+
+  // park under a unique id: the dead thread's tid may be reused while
+  // this heap sits in the pool, and must not alias its miniheaps
+  heap->setOwner(_nextParkedId.fetch_sub(1, std::memory_order_relaxed), heap->_pthreadCurrent);
+
+  RecycleShard &shard = _recycleShards[recycleShardIndex()];
+
+  uint32_t expected = 0;
+  while (!shard.lock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+    expected = 0;
+  }
+
+  if (shard.count >= kMaxPooledHeapsPerShard) {
+    shard.lock.store(0, std::memory_order_release);
+    return false;
+  }
+
+  heap->_next = shard.head;
+  shard.head = heap;
+  shard.count++;
+
+  shard.lock.store(0, std::memory_order_release);
+  return true;
+}
+
+ThreadLocalHeap *ThreadLocalHeap::TryAdoptLocked(pthread_t current) {
+  RecycleShard &shard = _recycleShards[recycleShardIndex()];
+
+  uint32_t expected = 0;
+  while (!shard.lock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+    expected = 0;
+  }
+
+  ThreadLocalHeap *heap = shard.head;
+  if (heap != nullptr) {
+    shard.head = heap->_next;
+    shard.count--;
+  }
+
+  shard.lock.store(0, std::memory_order_release);
+
+  if (heap == nullptr) {
+    return nullptr;
+  }
+
+  heap->setOwner(gettid(), current);
+
+  // relink into the live-heap list (caller holds the global heap lock)
+  heap->_prev = nullptr;
+  heap->_next = _threadLocalHeaps;
+  if (_threadLocalHeaps != nullptr) {
+    _threadLocalHeaps->_prev = heap;
+  }
+  _threadLocalHeaps = heap;
+
+  return heap;
+}
+
+void ThreadLocalHeap::ResetRecyclePoolAfterFork() {
+  for (size_t i = 0; i < kRecycleShards; i++) {
+    _recycleShards[i].lock.store(0, std::memory_order_relaxed);
+  }
+}
+
+void ThreadLocalHeap::AggregateStatsLocked(unsigned long long *allocCount, unsigned long long *freeCount) {
+  unsigned long long allocs = _retiredAllocCount.load(std::memory_order_relaxed);
+  unsigned long long frees = _retiredFreeCount.load(std::memory_order_relaxed);
+
+  for (ThreadLocalHeap *h = _threadLocalHeaps; h != nullptr; h = h->_next) {
+    allocs += h->_stats.allocCount;
+    frees += h->_stats.freeCount;
+  }
+
+  if (_perCpuMode) {
+    for (size_t i = 0; i < _cpuHeapCount; i++) {
+      allocs += _cpuHeaps[i]->_stats.allocCount;
+      frees += _cpuHeaps[i]->_stats.freeCount;
+    }
+  }
+
+  *allocCount = allocs;
+  *freeCount = frees;
+}
+
+
+// ---- sampling heap profiler ----------------------------------------
+
+ssize_t HeapProfiler::_sampleInterval{0};
+atomic<uint32_t> HeapProfiler::_tableLock{0};
+ProfileSample *HeapProfiler::_samples{nullptr};
+size_t HeapProfiler::_sampleCount{0};
+
+void HeapProfiler::enable(ssize_t everyBytes) {
+  if (everyBytes <= 0) {
+    return;
+  }
+  _sampleInterval = everyBytes;
+}
+
+void HeapProfiler::flush(const ProfileSample *samples, size_t count) {
+  uint32_t expected = 0;
+  while (!_tableLock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+    expected = 0;
+  }
+
+  if (_samples == nullptr) {
+    _samples = reinterpret_cast<ProfileSample *>(internal::Heap().malloc(kProfileMaxSamples * sizeof(ProfileSample)));
+  }
+
+  for (size_t i = 0; i < count && _sampleCount < kProfileMaxSamples; i++) {
+    _samples[_sampleCount++] = samples[i];
+  }
+
+  _tableLock.store(0, std::memory_order_release);
+}
+
+int HeapProfiler::dumpProfile(const char *path) {
+  // flush the calling thread's buffer so fresh samples show up;
+  // other threads' partial buffers (at most kProfileThreadBufferLen
+  // samples each) are picked up on their next flush
+  ThreadLocalHeap *heap = ThreadLocalHeap::GetHeapIfPresent();
+  if (heap != nullptr) {
+    heap->flushProfileBuffer();
+  }
+
+  const int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+
+  uint32_t expected = 0;
+  while (!_tableLock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+    expected = 0;
+  }
+
+  char line[1024];
+  int len = snprintf(line, sizeof(line), "heap profile:      1:        1 [     1:        1] @ heap/%zd\n",
+                     _sampleInterval);
+  auto _ __attribute__((unused)) = write(fd, line, len);
+
+  // aggregate samples sharing a stack into one bucket.  samples are
+  // the raw sampled allocations; pprof applies the interval scaling.
+  static bool visited[kProfileMaxSamples];
+  memset(visited, 0, sizeof(visited));
+
+  for (size_t i = 0; i < _sampleCount; i++) {
+    if (visited[i]) {
+      continue;
+    }
+
+    uint64_t bytes = _samples[i].bytes;
+    uint64_t count = 1;
+    for (size_t j = i + 1; j < _sampleCount; j++) {
+      if (visited[j] || _samples[j].depth != _samples[i].depth) {
+        continue;
+      }
+      if (memcmp(_samples[j].stack, _samples[i].stack, _samples[i].depth * sizeof(void *)) != 0) {
+        continue;
+      }
+      visited[j] = true;
+      bytes += _samples[j].bytes;
+      count++;
+    }
+
+    len = snprintf(line, sizeof(line), "%8llu: %8llu [%8llu: %8llu] @",
+                   static_cast<unsigned long long>(count), static_cast<unsigned long long>(bytes),
+                   static_cast<unsigned long long>(count), static_cast<unsigned long long>(bytes));
+    _ = write(fd, line, len);
+    for (uint32_t d = 0; d < _samples[i].depth; d++) {
+      len = snprintf(line, sizeof(line), " %p", _samples[i].stack[d]);
+      _ = write(fd, line, len);
+    }
+    _ = write(fd, "\n", 1);
+  }
+
+  _tableLock.store(0, std::memory_order_release);
+
+  // pprof needs the mappings to symbolize
+  len = snprintf(line, sizeof(line), "\nMAPPED_LIBRARIES:\n");
+  _ = write(fd, line, len);
+  const int mapsFd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (mapsFd >= 0) {
+    ssize_t n;
+    while ((n = read(mapsFd, line, sizeof(line))) > 0) {
+      _ = write(fd, line, n);
+    }
+    close(mapsFd);
+  }
+
+  close(fd);
+  return 0;
+}
+
+void ThreadLocalHeap::profileSample(size_t sz) {
+  if (!HeapProfiler::enabled()) {
+    _profileCountdown = HeapProfiler::kDisabledCountdown;
+    return;
+  }
+
+  _profileCountdown = HeapProfiler::sampleInterval();
+
+  if (_profileBuffer == nullptr) {
+    _profileBuffer =
+        reinterpret_cast<ProfileSample *>(internal::Heap().malloc(kProfileThreadBufferLen * sizeof(ProfileSample)));
+  }
+
+  ProfileSample &sample = _profileBuffer[_profileBufferLen];
+  sample.bytes = sz;
+  // skip profileSample + malloc's own frame
+  sample.depth = static_cast<uint32_t>(captureStack(sample.stack, kProfileMaxStackDepth, 2));
+  _profileBufferLen++;
+
+  if (_profileBufferLen == kProfileThreadBufferLen) {
+    flushProfileBuffer();
+  }
+}
+
+void ThreadLocalHeap::flushProfileBuffer() {
+  if (_profileBufferLen == 0) {
+    return;
+  }
+  HeapProfiler::flush(_profileBuffer, _profileBufferLen);
+  _profileBufferLen = 0;
+}
+
+// --------------------------------------------------------------------
+
 void ThreadLocalHeap::DestroyThreadLocalHeap(void *ptr) {
-  if (ptr != nullptr) {
+  if (ptr == nullptr) {
+    return;
+  }
 #ifdef MESH_HAVE_TLS
-    _threadLocalHeap = nullptr;
+  _threadLocalHeap = nullptr;
 #endif
-    DeleteHeap(reinterpret_cast<ThreadLocalHeap *>(ptr));
+  auto heap = reinterpret_cast<ThreadLocalHeap *>(ptr);
+
+  // flush before taking the global heap lock below: both paths
+  // acquire lock shards of their own
+  heap->flushFreeBuffer();
+  heap->flushProfileBuffer();
+
+  {
+    // the live-heap list is owned by the global heap lock --
+    // CreateHeapIfNecessary's reentrancy scan, TryAdoptLocked's
+    // relink, and AggregateStatsLocked's walk all run under it -- so
+    // the unlink must too, symmetric with the relink
+    std::lock_guard<GlobalHeap> lock(mesh::runtime().heap());
+
+    if (heap->_next != nullptr) {
+      heap->_next->_prev = heap->_prev;
+    }
+    if (heap->_prev != nullptr) {
+      heap->_prev->_next = heap->_next;
+    }
+    if (_threadLocalHeaps == heap) {
+      _threadLocalHeaps = heap->_next;
+    }
+    heap->_prev = nullptr;
+    heap->_next = nullptr;
   }
+
+  if (TryRecycle(heap)) {
+    return;
+  }
+  DeleteHeap(heap);
 }
 
 // similar to what TCMalloc does; the constructor initializes our
@@ -44,7 +383,7 @@ void ThreadLocalHeap::InitTLH() {
 ThreadLocalHeap *ThreadLocalHeap::NewHeap(pthread_t current) {
   // we just allocate out of our internal heap
   void *buf = mesh::internal::Heap().malloc(sizeof(ThreadLocalHeap));
-  static_assert(sizeof(ThreadLocalHeap) < 4096 * 8, "tlh should have a reasonable size");
+  static_assert(sizeof(ThreadLocalHeap) < 4096 * 16, "tlh should have a reasonable size");
   hard_assert(buf != nullptr);
   hard_assert(reinterpret_cast<uintptr_t>(buf) % CACHELINE_SIZE == 0);
 
@@ -87,6 +426,11 @@ ThreadLocalHeap *ThreadLocalHeap::CreateHeapIfNecessary() {
       }
     }
 
+    if (heap == nullptr) {
+      // prefer adopting a warm retired heap over building a cold one
+      heap = TryAdoptLocked(current);
+    }
+
     if (heap == nullptr) {
       heap = NewHeap(current);
     }
@@ -104,28 +448,82 @@ ThreadLocalHeap *ThreadLocalHeap::CreateHeapIfNecessary() {
   return heap;
 }
 
+// caller must already have unlinked the heap from the live-heap list
+// under the global heap lock (see DestroyThreadLocalHeap)
 void ThreadLocalHeap::DeleteHeap(ThreadLocalHeap *heap) {
   if (heap == nullptr) {
     return;
   }
 
+  d_assert(heap->_prev == nullptr && heap->_next == nullptr && _threadLocalHeaps != heap);
+
+  heap->flushProfileBuffer();
+
+  _retiredAllocCount.fetch_add(heap->_stats.allocCount, std::memory_order_relaxed);
+  _retiredFreeCount.fetch_add(heap->_stats.freeCount, std::memory_order_relaxed);
+
   // manually invoke the destructor
   heap->ThreadLocalHeap::~ThreadLocalHeap();
 
-  if (heap->_next != nullptr) {
-    heap->_next->_prev = heap->_prev;
-  }
-  if (heap->_prev != nullptr) {
-    heap->_prev->_next = heap->_next;
+  mesh::internal::Heap().free(reinterpret_cast<void *>(heap));
+}
+
+// estimated bytes one attached miniheap of this class spans
+static size_t spanBytesForClass(size_t sizeClass) {
+  const size_t objectSize = SizeMap::ByteSizeForClass(sizeClass);
+  const size_t objectCount = objectSize >= kPageSize ? 4 : std::max(kPageSize / objectSize, kMinStringLen);
+  return RoundUpToPage(objectSize * objectCount);
+}
+
+// adaptive cache sizing, run from the refill slow path roughly once
+// per decay interval: classes that refilled often grow their attach
+// target (within the per-thread byte budget); classes that didn't
+// refill at all give their cached miniheaps back and shrink.
+void ThreadLocalHeap::maybeAdaptCaches(size_t hotSizeClass) {
+  const auto now = time::now();
+  if (now - _lastCacheDecay < kCacheDecayIntervalMs) {
+    return;
   }
-  if (_threadLocalHeaps == heap) {
-    _threadLocalHeaps = heap->_next;
+  _lastCacheDecay = now;
+
+  // drain buffered cross-thread frees on the same clock, so an idle
+  // thread's buffer doesn't retain freed memory (or overstate
+  // occupancy to the mesh scan) indefinitely
+  flushFreeBuffer();
+
+  size_t budgetedBytes = 0;
+  for (size_t i = 0; i < kNumBins; i++) {
+    budgetedBytes += _shuffleVector[i].targetAttach() * spanBytesForClass(i);
   }
 
-  mesh::internal::Heap().free(reinterpret_cast<void *>(heap));
+  for (size_t i = 1; i < kNumBins; i++) {
+    ShuffleVector &sv = _shuffleVector[i];
+
+    if (sv.refillsSinceDecay() >= kCacheHotRefillThreshold) {
+      const uint32_t target = sv.targetAttach();
+      if (target < kMaxMiniheapsPerShuffleVector) {
+        const uint32_t grown = std::min<uint32_t>(target * 2, kMaxMiniheapsPerShuffleVector);
+        const size_t extraBytes = (grown - target) * spanBytesForClass(i);
+        if (budgetedBytes + extraBytes <= kThreadCacheBytesBudget) {
+          sv.setTargetAttach(grown);
+          budgetedBytes += extraBytes;
+        }
+      }
+    } else if (sv.refillsSinceDecay() == 0 && i != hotSizeClass && sv.miniheaps().size() > 0) {
+      // cold class: return its cached memory so it stops stranding
+      // pages in an idle thread, and come back smaller next time
+      sv.refillMiniheaps();
+      _global->releaseMiniheaps(sv.miniheaps());
+      sv.shrinkTarget();
+    }
+
+    sv.resetRefillsSinceDecay();
+  }
 }
 
 void ThreadLocalHeap::releaseAll() {
+  flushFreeBuffer();
+
   for (size_t i = 1; i < kNumBins; i++) {
     _shuffleVector[i].refillMiniheaps();
     _global->releaseMiniheaps(_shuffleVector[i].miniheaps());
@@ -148,9 +546,14 @@ void *CACHELINE_ALIGNED_FN ThreadLocalHeap::smallAllocSlowpath(size_t sizeClass)
 }
 
 void *CACHELINE_ALIGNED_FN ThreadLocalHeap::smallAllocGlobalRefill(ShuffleVector &shuffleVector, size_t sizeClass) {
+  MESH_PROBE1(global_refill, sizeClass);
+
+  shuffleVector.noteRefill();
+  maybeAdaptCaches(sizeClass);
+
   const size_t sizeMax = SizeMap::ByteSizeForClass(sizeClass);
 
-  _global->allocSmallMiniheaps(sizeClass, sizeMax, shuffleVector.miniheaps(), _current);
+  _global->allocSmallMiniheaps(sizeClass, sizeMax, shuffleVector.miniheaps(), _current, shuffleVector.targetAttach());
   shuffleVector.reinit();
 
   d_assert(!shuffleVector.isExhausted());
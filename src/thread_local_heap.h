@@ -11,11 +11,16 @@
 #include <stdalign.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #include <sys/types.h>
 
 #include <algorithm>
 #include <atomic>
 
+#include "heap_profiler.h"
 #include "internal.h"
 #include "mini_heap.h"
 #include "shuffle_vector.h"
@@ -30,10 +35,13 @@ using namespace HL;
 
 namespace mesh {
 
+// plain (non-atomic) counters: each instance has a single writer --
+// its owning thread -- and readers aggregating a snapshot tolerate
+// torn values
 class LocalHeapStats {
 public:
-  atomic_size_t allocCount{0};
-  atomic_size_t freeCount{0};
+  size_t allocCount{0};
+  size_t freeCount{0};
 };
 
 class ThreadLocalHeap {
@@ -43,18 +51,26 @@ private:
 public:
   enum { Alignment = 16 };
 
-  ThreadLocalHeap(GlobalHeap *global, pthread_t pthreadCurrent)
-      : _current(gettid()),
+  // ownerId overrides the thread id used to mark attached miniheaps;
+  // per-CPU heaps pass distinct negative ids so each heap's miniheaps
+  // are recognized as their own (real tids are always positive), and
+  // the recycling pool re-tags parked heaps the same way
+  ThreadLocalHeap(GlobalHeap *global, pthread_t pthreadCurrent, pid_t ownerId = 0)
+      : _current(ownerId != 0 ? ownerId : gettid()),
         _global(global),
+        _arenaBegin(global->arenaBegin()),
         _pthreadCurrent(pthreadCurrent),
         _prng(internal::seed(), internal::seed()),
         _maxObjectSize(SizeMap::ByteSizeForClass(kNumBins - 1)) {
-    const auto arenaBegin = _global->arenaBegin();
+    const auto arenaBegin = _arenaBegin;
     // when asked, give 16-byte allocations for 0-byte requests
     _shuffleVector[0].initialInit(arenaBegin, SizeMap::ByteSizeForClass(1));
     for (size_t i = 1; i < kNumBins; i++) {
       _shuffleVector[i].initialInit(arenaBegin, SizeMap::ByteSizeForClass(i));
     }
+    if (unlikely(HeapProfiler::enabled())) {
+      _profileCountdown = HeapProfiler::sampleInterval();
+    }
     d_assert(_global != nullptr);
   }
 
@@ -70,8 +86,15 @@ public:
   void releaseAll();
 
   void *ATTRIBUTE_NEVER_INLINE CACHELINE_ALIGNED_FN smallAllocSlowpath(size_t sizeClass);
+  // record one sampled allocation and reset the countdown
+  void ATTRIBUTE_NEVER_INLINE profileSample(size_t sz);
+  // push any buffered samples to the global profile table
+  void flushProfileBuffer();
   void *ATTRIBUTE_NEVER_INLINE CACHELINE_ALIGNED_FN smallAllocGlobalRefill(ShuffleVector &shuffleVector,
                                                                            size_t sizeClass);
+  // grow hot classes' attach targets and flush+shrink cold ones;
+  // rate-limited to about once per decay interval
+  void maybeAdaptCaches(size_t hotSizeClass);
 
   inline void *memalign(size_t alignment, size_t size) {
     // Check for non power-of-two alignment.
@@ -90,13 +113,19 @@ public:
       auto ptr = this->malloc(size);
       d_assert_msg((reinterpret_cast<uintptr_t>(ptr) % alignment) == 0, "%p(%zu) %% %zu != 0", ptr, size, alignment);
       return ptr;
-    } else if (isSmall) {
-      const auto sizeClassBytes = SizeMap::ByteSizeForClass(sizeClass);
-      // if the alignment is for a small allocation that is less than
-      // the page size, and the size class size in bytes is a multiple
-      // of the alignment, just call malloc
-      if (sizeClassBytes <= kPageSize && alignment <= sizeClassBytes && (sizeClassBytes % alignment) == 0) {
-        auto ptr = this->malloc(size);
+    } else if (isSmall && alignment <= kPageSize) {
+      // spans are page-aligned, so a class whose stride is a multiple
+      // of the (power-of-two, <= page) alignment yields aligned slots
+      // at every offset.  Walk up to the first such class -- every
+      // power of two up to the page size has an exact class (64, 128,
+      // 256, ...), so this stays on the thread-local fast path
+      // instead of burning a page + the global lock per allocation.
+      uint32_t cl = sizeClass;
+      while (cl < static_cast<uint32_t>(kNumBins) && (SizeMap::ByteSizeForClass(cl) % alignment) != 0) {
+        cl++;
+      }
+      if (likely(cl < static_cast<uint32_t>(kNumBins))) {
+        auto ptr = this->malloc(SizeMap::ByteSizeForClass(cl));
         d_assert_msg((reinterpret_cast<uintptr_t>(ptr) % alignment) == 0, "%p(%zu) %% %zu != 0", ptr, size, alignment);
         return ptr;
       }
@@ -126,6 +155,12 @@ public:
     const size_t upperBoundToShrink = oldSize / 2ul;
 
     if (newSize > oldSize || newSize < upperBoundToShrink) {
+      // for page-backed allocations, growing in place by claiming the
+      // adjacent span is far cheaper than malloc+memcpy+free
+      if (newSize > oldSize && oldSize >= kPageSize && _global->tryReallocInPlace(oldPtr, newSize)) {
+        return oldPtr;
+      }
+
       void *newPtr = nullptr;
       if (newSize > oldSize && newSize < lowerBoundToGrow) {
         newPtr = this->malloc(lowerBoundToGrow);
@@ -153,6 +188,20 @@ public:
     }
 
     const size_t n = count * size;
+
+    uint32_t sizeClass = 0;
+    if (unlikely(!SizeMap::GetSizeClass(n, &sizeClass))) {
+      // page-backed: the arena knows whether the span already reads
+      // as zero, in which case the memset (and the page-fault doubling
+      // it causes) is pure waste
+      bool zeroed = false;
+      void *ptr = _global->malloc(n, &zeroed);
+      if (ptr != nullptr && !zeroed) {
+        memset(ptr, 0, n);
+      }
+      return ptr;
+    }
+
     void *ptr = this->malloc(n);
 
     if (ptr != nullptr) {
@@ -175,11 +224,57 @@ public:
   inline void *ATTRIBUTE_ALWAYS_INLINE malloc(size_t sz) {
     uint32_t sizeClass = 0;
 
+    _stats.allocCount++;
+
+    // sampling profiler: a single decrement-and-branch when disabled
+    // (the countdown starts effectively infinite)
+    if (unlikely((_profileCountdown -= static_cast<ssize_t>(sz)) < 0)) {
+      profileSample(sz);
+    }
+
     // if the size isn't in our sizemap it is a large alloc
     if (unlikely(!SizeMap::GetSizeClass(sz, &sizeClass))) {
       return _global->malloc(sz);
     }
 
+    return mallocSmall(sizeClass);
+  }
+
+  // entry point for callers that resolved the size class at compile
+  // time (mesh::alloc<N> in mesh_alloc.h): no class_array_ lookup at
+  // all, just the counters and the shuffle vector index
+  inline void *ATTRIBUTE_ALWAYS_INLINE mallocInClass(uint32_t sizeClass) {
+    d_assert(sizeClass < static_cast<uint32_t>(kNumBins));
+
+    _stats.allocCount++;
+
+    const size_t sz = SizeMap::ByteSizeForClass(sizeClass);
+    if (unlikely((_profileCountdown -= static_cast<ssize_t>(sz)) < 0)) {
+      profileSample(sz);
+    }
+
+    return mallocSmall(sizeClass);
+  }
+
+  // the compile-time twin of sizedFree
+  inline void ATTRIBUTE_ALWAYS_INLINE freeInClass(void *ptr, uint32_t sizeClass) {
+    if (unlikely(ptr == nullptr))
+      return;
+
+    _stats.freeCount++;
+
+    size_t startEpoch{0};
+    auto mh = miniheapForCached(ptr, startEpoch);
+    if (likely(mh && mh->current() == _current && !mh->hasMeshed() &&
+               static_cast<uint32_t>(mh->sizeClass()) == sizeClass)) {
+      _shuffleVector[sizeClass].free(mh, ptr);
+      return;
+    }
+
+    _global->freeFor(mh, ptr, startEpoch);
+  }
+
+  inline void *ATTRIBUTE_ALWAYS_INLINE mallocSmall(uint32_t sizeClass) {
     ShuffleVector &shuffleVector = _shuffleVector[sizeClass];
     if (unlikely(shuffleVector.isExhausted())) {
       return smallAllocSlowpath(sizeClass);
@@ -188,30 +283,128 @@ public:
     return shuffleVector.malloc();
   }
 
+  // small direct-mapped cache of ptr-page -> MiniHeap translations,
+  // so the common free-to-a-hot-miniheap avoids the cold _mhIndex
+  // cacheline in the arena entirely.  An entry is only ever returned
+  // when the miniheap is still attached to this thread and its span
+  // still covers the page, which makes stale entries (a released or
+  // recycled miniheap) detectably invalid; the whole cache is dropped
+  // whenever the mesh epoch moves.
+  inline MiniHeap *ATTRIBUTE_ALWAYS_INLINE miniheapForCached(const void *ptr, size_t &currentEpoch) {
+    const auto arena = reinterpret_cast<uintptr_t>(_arenaBegin);
+    const auto ptrval = reinterpret_cast<uintptr_t>(ptr);
+    const bool inArena = arena <= ptrval && ptrval < arena + kArenaSize;
+    const uint32_t pageOff = static_cast<uint32_t>((ptrval - arena) / kPageSize);
+
+    currentEpoch = _global->meshEpoch();
+
+    if (unlikely(currentEpoch != _mhCacheEpoch)) {
+      // a mesh has started (or finished) since we last looked;
+      // anything we cached may have been relocated
+      for (size_t i = 0; i < kLookupCacheSize; i++) {
+        _mhCache[i].mh = nullptr;
+      }
+      _mhCacheEpoch = currentEpoch;
+    } else if (likely(inArena)) {
+      MiniheapCacheEntry &entry = _mhCache[pageOff & (kLookupCacheSize - 1)];
+      MiniHeap *mh = entry.mh;
+      if (mh != nullptr && entry.pageOff == pageOff) {
+        const auto span = mh->span();
+        if (likely(span.offset <= pageOff && pageOff < span.offset + span.length && mh->current() == _current &&
+                   !mh->hasMeshed())) {
+          return mh;
+        }
+        entry.mh = nullptr;
+      }
+    }
+
+    auto mh = _global->miniheapForWithEpoch(ptr, currentEpoch);
+    if (likely(inArena) && mh != nullptr && currentEpoch % 2 == 0 && mh->current() == _current && !mh->hasMeshed()) {
+      MiniheapCacheEntry &entry = _mhCache[pageOff & (kLookupCacheSize - 1)];
+      entry.mh = mh;
+      entry.pageOff = pageOff;
+    }
+
+    return mh;
+  }
+
   inline void ATTRIBUTE_ALWAYS_INLINE free(void *ptr) {
     if (unlikely(ptr == nullptr))
       return;
 
+    _stats.freeCount++;
+
     size_t startEpoch{0};
-    auto mh = _global->miniheapForWithEpoch(ptr, startEpoch);
+    auto mh = miniheapForCached(ptr, startEpoch);
     if (likely(mh && mh->current() == _current && !mh->hasMeshed())) {
       ShuffleVector &shuffleVector = _shuffleVector[mh->sizeClass()];
       shuffleVector.free(mh, ptr);
       return;
     }
 
-    _global->freeFor(mh, ptr, startEpoch);
+    // large frees and untracked pointers go straight through (a large
+    // free returns real memory; don't sit on it), but small frees
+    // that miss are buffered and flushed as one batch
+    if (unlikely(mh == nullptr || mh->isLargeAlloc())) {
+      _global->freeFor(mh, ptr, startEpoch);
+      return;
+    }
+
+    _freeBuffer[_freeBufferLen++] = ptr;
+    _freeBufferBytes += mh->objectSize();
+    if (unlikely(_freeBufferLen == kFreeBufferSize || _freeBufferBytes >= kFreeBufferMaxBytes)) {
+      flushFreeBuffer();
+    }
+  }
+
+  // hand any buffered cross-thread frees to the global heap in one
+  // pass; called when the buffer fills (by slots or bytes), from the
+  // once-per-second decay pass, and on thread teardown
+  void flushFreeBuffer() {
+    if (_freeBufferLen == 0) {
+      return;
+    }
+    const size_t len = _freeBufferLen;
+    _freeBufferLen = 0;
+    _freeBufferBytes = 0;
+    _global->freeBatch(_freeBuffer, len);
   }
 
   inline void ATTRIBUTE_ALWAYS_INLINE sizedFree(void *ptr, size_t sz) {
-    this->free(ptr);
+    if (unlikely(ptr == nullptr))
+      return;
+
+    uint32_t sizeClass = 0;
+    if (unlikely(!SizeMap::GetSizeClass(sz, &sizeClass))) {
+      // page-backed allocation; no small-object fast path to take
+      this->free(ptr);
+      return;
+    }
+
+    _stats.freeCount++;
+
+    size_t startEpoch{0};
+    auto mh = miniheapForCached(ptr, startEpoch);
+    // the size C++ hands us tells us which shuffle vector to push
+    // into; the miniheap's own class field doubles as the validation
+    // tag.  A mismatch (e.g. a memalign that fell back to a
+    // page-aligned span, or a buggy sized delete) takes the general
+    // path, which re-derives everything from the miniheap.
+    if (likely(mh && mh->current() == _current && !mh->hasMeshed() &&
+               static_cast<uint32_t>(mh->sizeClass()) == sizeClass)) {
+      _shuffleVector[sizeClass].free(mh, ptr);
+      return;
+    }
+
+    _global->freeFor(mh, ptr, startEpoch);
   }
 
   inline size_t getSize(void *ptr) {
     if (unlikely(ptr == nullptr))
       return 0;
 
-    auto mh = _global->miniheapFor(ptr);
+    size_t epoch{0};
+    auto mh = miniheapForCached(ptr, epoch);
     if (likely(mh && mh->current() == _current)) {
       ShuffleVector &shuffleVector = _shuffleVector[mh->sizeClass()];
       return shuffleVector.getSize();
@@ -220,6 +413,151 @@ public:
     return _global->getSize(ptr);
   }
 
+  // --- per-CPU cache mode -------------------------------------------
+  //
+  // For thread-per-request services with thousands of mostly-idle
+  // threads, per-thread shuffle vectors dominate RSS.  In per-CPU
+  // mode (MESH_PERCPU_CACHE=1) no thread-local heaps are created;
+  // instead a fixed array of per-CPU heaps is shared by all threads,
+  // bounding cache memory by core count.  A true rseq commit sequence
+  // would avoid the lock entirely, but needs per-arch assembly; a
+  // per-CPU spinlock is uncontended except when a thread is preempted
+  // mid-allocation or migrates, and delivers the same memory bound.
+
+  static inline bool ATTRIBUTE_ALWAYS_INLINE perCpuMode() {
+    return _perCpuMode;
+  }
+
+  // called from libmesh_init; must run before any heap is created
+  static void EnablePerCpuMode();
+
+  // after fork only the calling thread survives; locks (and possibly
+  // half-updated cache state) held by dead threads are abandoned, so
+  // the child starts over with fresh per-CPU heaps
+  static void ResetCpuHeapsAfterFork();
+
+  inline void lockSpin() {
+    uint32_t expected = 0;
+    while (!_spinLock.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+      expected = 0;
+    }
+  }
+
+  inline void unlockSpin() {
+    _spinLock.store(0, std::memory_order_release);
+  }
+
+  static inline ThreadLocalHeap *LockedCpuHeap() {
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (unlikely(cpu < 0)) {
+      cpu = 0;
+    }
+#else
+    int cpu = 0;
+#endif
+    ThreadLocalHeap *heap = _cpuHeaps[static_cast<size_t>(cpu) % _cpuHeapCount];
+    heap->lockSpin();
+    return heap;
+  }
+
+  static void *CpuMalloc(size_t sz) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    void *ptr = heap->malloc(sz);
+    heap->unlockSpin();
+    return ptr;
+  }
+
+  static void *CpuCxxNew(size_t sz) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    void *ptr = heap->malloc(sz);
+    heap->unlockSpin();
+    if (unlikely(ptr == NULL && sz != 0)) {
+      throw std::bad_alloc();
+    }
+    return ptr;
+  }
+
+  static void CpuFree(void *ptr) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    heap->free(ptr);
+    heap->unlockSpin();
+  }
+
+  static void CpuSizedFree(void *ptr, size_t sz) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    heap->sizedFree(ptr, sz);
+    heap->unlockSpin();
+  }
+
+  static void *CpuRealloc(void *oldPtr, size_t newSize) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    void *ptr = heap->realloc(oldPtr, newSize);
+    heap->unlockSpin();
+    return ptr;
+  }
+
+  static void *CpuCalloc(size_t count, size_t size) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    void *ptr = heap->calloc(count, size);
+    heap->unlockSpin();
+    return ptr;
+  }
+
+  static size_t CpuGetSize(void *ptr) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    const size_t sz = heap->getSize(ptr);
+    heap->unlockSpin();
+    return sz;
+  }
+
+  static void *CpuMemalign(size_t alignment, size_t size) {
+    ThreadLocalHeap *heap = LockedCpuHeap();
+    void *ptr = heap->memalign(alignment, size);
+    heap->unlockSpin();
+    return ptr;
+  }
+  // ------------------------------------------------------------------
+
+  // --- retired-heap recycling ---------------------------------------
+  //
+  // Connection pools churn threads constantly; rather than flushing
+  // all 25 shuffle vectors through the global heap on every thread
+  // death and rebuilding them on every birth, retired heaps are parked
+  // on a small pool and adopted warm -- attached miniheaps, populated
+  // shuffle vectors and all -- by the next new thread.
+
+  // re-tag this heap (and every miniheap attached to its shuffle
+  // vectors) with a new owner
+  void setOwner(pid_t owner, pthread_t pthreadCurrent) {
+    _current = owner;
+    _pthreadCurrent = pthreadCurrent;
+    for (size_t i = 0; i < kNumBins; i++) {
+      for (auto mh : _shuffleVector[i].miniheaps()) {
+        mh->setAttached(owner, nullptr);
+      }
+    }
+  }
+
+  // park a retired heap; returns false (caller should tear it down)
+  // when the pool is full
+  static bool TryRecycle(ThreadLocalHeap *heap);
+
+  // adopt a previously parked heap for the calling thread; must be
+  // called with the global heap lock held (it relinks the heap list).
+  // Returns nullptr when the pool is empty.
+  static ThreadLocalHeap *TryAdoptLocked(pthread_t current);
+
+  // fork children abandon any in-flight pool operations from dead
+  // threads by resetting the shard locks
+  static void ResetRecyclePoolAfterFork();
+  // ------------------------------------------------------------------
+
+  // sum alloc/free counters across live heaps, per-CPU heaps, and
+  // what retired heaps folded in; must be called with the global heap
+  // lock held (it walks the live-heap list)
+  static void AggregateStatsLocked(unsigned long long *allocCount, unsigned long long *freeCount);
+
   static ThreadLocalHeap *NewHeap(pthread_t current);
   static ThreadLocalHeap *GetHeapIfPresent() {
 #ifdef MESH_HAVE_TLS
@@ -242,13 +580,38 @@ public:
   static ThreadLocalHeap *ATTRIBUTE_NEVER_INLINE CreateHeapIfNecessary();
 
 protected:
+  struct MiniheapCacheEntry {
+    MiniHeap *mh{nullptr};
+    uint32_t pageOff{0};
+  };
+  // must be a power of two
+  static constexpr size_t kLookupCacheSize = 16;
+
   ShuffleVector _shuffleVector[kNumBins] CACHELINE_ALIGNED;
-  // this cacheline is read-mostly (only changed when creating + destroying threads)
-  const pid_t _current CACHELINE_ALIGNED{0};
+  MiniheapCacheEntry _mhCache[kLookupCacheSize] CACHELINE_ALIGNED{};
+  size_t _mhCacheEpoch{0};
+  // cross-thread frees waiting to be flushed as one batch
+  void *_freeBuffer[kFreeBufferSize]{};
+  size_t _freeBufferLen{0};
+  size_t _freeBufferBytes{0};
+  // bytes until the next profile sample; effectively infinite when
+  // the profiler is disabled
+  ssize_t _profileCountdown{HeapProfiler::kDisabledCountdown};
+  // last run of the adaptive cache decay pass
+  time::time_point _lastCacheDecay{time::now()};
+  // lazily allocated when the first sample lands on this thread
+  ProfileSample *_profileBuffer{nullptr};
+  size_t _profileBufferLen{0};
+  // only used in per-CPU mode, where the heap is shared
+  atomic<uint32_t> _spinLock{0};
+  // this cacheline is read-mostly (only changed when creating,
+  // destroying, or adopting threads)
+  pid_t _current CACHELINE_ALIGNED{0};
   GlobalHeap *_global;
+  const char *_arenaBegin;
   ThreadLocalHeap *_next{};  // protected by global heap lock
   ThreadLocalHeap *_prev{};
-  const pthread_t _pthreadCurrent;
+  pthread_t _pthreadCurrent;
   MWC _prng CACHELINE_ALIGNED;
   const size_t _maxObjectSize;
   LocalHeapStats _stats{};
@@ -261,6 +624,33 @@ protected:
   static ThreadLocalHeap *_threadLocalHeaps;
   static bool _tlhInitialized;
   static pthread_key_t _heapKey;
+
+  static bool _perCpuMode;
+  static ThreadLocalHeap **_cpuHeaps;
+  static size_t _cpuHeapCount;
+
+  // sharded by CPU as a crude locality key (no libnuma dependency):
+  // threads retiring and starting on the same core hash to the same
+  // shard, so a heap tends to be re-adopted near where it was warm
+  static constexpr size_t kRecycleShards = 4;
+  static constexpr size_t kMaxPooledHeapsPerShard = 16;
+
+  struct RecycleShard {
+    atomic<uint32_t> lock{0};
+    ThreadLocalHeap *head{nullptr};
+    size_t count{0};
+  };
+
+  static RecycleShard _recycleShards[kRecycleShards];
+  static size_t recycleShardIndex();
+
+  // counters folded in from heaps that were parked or torn down
+  static atomic_size_t _retiredAllocCount;
+  static atomic_size_t _retiredFreeCount;
+  // distinct ids for parked heaps, so a recycled tid can never alias
+  // a parked heap's attached miniheaps; kept well away from the
+  // per-CPU heaps' small negative ids
+  static atomic<pid_t> _nextParkedId;
 };
 
 }  // namespace mesh
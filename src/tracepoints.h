@@ -0,0 +1,47 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright 2019 The Mesh Authors. All rights reserved.
+// Use of this source code is governed by the Apache License,
+// Version 2.0, that can be found in the LICENSE file.
+
+#pragma once
+#ifndef MESH_TRACEPOINTS_H
+#define MESH_TRACEPOINTS_H
+
+// USDT probes under the "mesh" provider.  These compile to a single
+// nop plus an ELF note, so they're always built in; bpftrace/perf
+// patch them live in production:
+//
+//   bpftrace -e 'usdt:libmesh.so:mesh:mesh_begin { @pages = hist(arg2); }'
+//
+// On platforms without <sys/sdt.h> they compile away entirely.
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MESH_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef MESH_HAVE_USDT
+#define MESH_PROBE1(name, a1) DTRACE_PROBE1(mesh, name, a1)
+#define MESH_PROBE2(name, a1, a2) DTRACE_PROBE2(mesh, name, a1, a2)
+#define MESH_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(mesh, name, a1, a2, a3)
+#else
+#define MESH_PROBE1(name, a1) \
+  do {                        \
+    (void)(a1);               \
+  } while (0)
+#define MESH_PROBE2(name, a1, a2) \
+  do {                            \
+    (void)(a1);                   \
+    (void)(a2);                   \
+  } while (0)
+#define MESH_PROBE3(name, a1, a2, a3) \
+  do {                                \
+    (void)(a1);                       \
+    (void)(a2);                       \
+    (void)(a3);                       \
+  } while (0)
+#endif
+
+#endif  // MESH_TRACEPOINTS_H
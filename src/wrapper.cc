@@ -349,7 +349,7 @@ MESH_EXPORT CACHELINE_ALIGNED_FN void operator delete(void *ptr, size_t sz)
   return localHeap->sizedFree(ptr, sz);
 }
 
-MESH_EXPORT CACHELINE_ALIGNED_FN void operator delete[](void *ptr, size_t)
+MESH_EXPORT CACHELINE_ALIGNED_FN void operator delete[](void *ptr, size_t sz)
 #if defined(__GNUC__)
     _GLIBCXX_USE_NOEXCEPT
 #endif
@@ -360,7 +360,7 @@ MESH_EXPORT CACHELINE_ALIGNED_FN void operator delete[](void *ptr, size_t)
     return;
   }
 
-  return localHeap->free(ptr);
+  return localHeap->sizedFree(ptr, sz);
 }
 #endif
 